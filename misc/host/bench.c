@@ -0,0 +1,1080 @@
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
+ */
+
+/* Runs the input pipeline on the host and reports ns per report, so changes to the hot paths
+ * can be compared without hardware. Absolute numbers don't translate to the RP2040, ratios do. */
+
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "host.h"
+
+#define ITERATIONS 1000000
+
+static hid_interface_t mouse_iface, keyboard_iface;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report(const char *name, uint64_t elapsed_ns, int count) {
+    printf("%-24s %8.1f ns/report\n", name, (double)elapsed_ns / count);
+}
+
+static void setup_interface(hid_interface_t *iface, const uint8_t *descriptor, int len) {
+    memset(iface, 0, sizeof(hid_interface_t));
+    parse_report_descriptor(iface, descriptor, len);
+    iface->protocol = HID_PROTOCOL_REPORT;
+}
+
+/* Raw report in, queued and handed to the device stack out */
+static void bench_mouse(device_t *state) {
+    uint8_t raw[7] = {0};
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        /* Back and forth, so the cursor stays away from the screen edges */
+        int16_t move = (i & 1) ? (i & 0x3E) + 1 : -((i & 0x3E) + 1);
+
+        memcpy(&raw[1], &move, sizeof(move));
+        memcpy(&raw[3], &move, sizeof(move));
+
+        process_mouse_report(raw, sizeof(raw), 0, &mouse_iface);
+        process_mouse_queue_task(state);
+    }
+
+    report("mouse", now_ns() - start, ITERATIONS);
+}
+
+/* Acceleration as it was before the Q12 lookup table: sqrtf and float interpolation per report,
+   then float multiplies and round(). Kept here to compare against update_mouse_position(). */
+static float float_acceleration_factor(device_t *state, int32_t offset_x, int32_t offset_y) {
+    static const struct {
+        int value;
+        float factor;
+    } curve[ACCEL_POINTS] = {{2, 1}, {5, 1.1}, {15, 1.4}, {30, 1.9}, {45, 2.6}, {60, 3.4}, {70, 4.0}};
+
+    if ((offset_x == 0 && offset_y == 0) || !state->config.enable_acceleration)
+        return 1.0;
+
+    const float magnitude = sqrtf((float)(offset_x * offset_x) + (float)(offset_y * offset_y));
+
+    if (magnitude <= curve[0].value)
+        return curve[0].factor;
+
+    if (magnitude >= curve[ACCEL_POINTS - 1].value)
+        return curve[ACCEL_POINTS - 1].factor;
+
+    for (int i = 0; i < ACCEL_POINTS - 1; i++)
+        if (magnitude < curve[i + 1].value)
+            return curve[i].factor + (magnitude - curve[i].value) / (curve[i + 1].value - curve[i].value)
+                                         * (curve[i + 1].factor - curve[i].factor);
+
+    return 1.0;
+}
+
+static void float_mouse_position(device_t *state, mouse_values_t *values) {
+    output_t *current = &state->config.output[state->active_output];
+    float factor      = float_acceleration_factor(state, values->move_x, values->move_y);
+
+    state->pointer_x = move_and_keep_on_screen(state->pointer_x, round(values->move_x * factor * current->speed_x));
+    state->pointer_y = move_and_keep_on_screen(state->pointer_y, round(values->move_y * factor * current->speed_y));
+}
+
+/* Only the movement math, before and after, over magnitudes that cover the whole curve. The host has an
+   FPU, on the RP2040 every float operation above is a soft-float library call, so the gap is wider there. */
+static void bench_acceleration(device_t *state) {
+    mouse_values_t values = {0};
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        values.move_x = (i & 1) ? (i & 0x3F) + 1 : -((i & 0x3F) + 1);
+        values.move_y = -values.move_x / 2;
+        float_mouse_position(state, &values);
+    }
+
+    report("acceleration, float", now_ns() - start, ITERATIONS);
+    start = now_ns();
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        values.move_x = (i & 1) ? (i & 0x3F) + 1 : -((i & 0x3F) + 1);
+        values.move_y = -values.move_x / 2;
+        update_mouse_position(state, &values);
+    }
+
+    report("acceleration, Q12 table", now_ns() - start, ITERATIONS);
+}
+
+/* MAX_TASKS_PER_CORE periodic tasks at 1 to 8 kHz that do nothing, so what's measured is dispatching
+   them. The loop the scheduler replaced read the timer and checked every task on every pass and never
+   slept, all of its time is overhead. For the deadline heap only the time spent awake counts. */
+#define SCHEDULER_RUN_US 200000
+
+static uint32_t scheduler_runs;
+
+static void count_run(device_t *state) {
+    scheduler_runs++;
+}
+
+static void setup_scheduler_tasks(task_t *tasks) {
+    for (int i = 0; i < MAX_TASKS_PER_CORE; i++)
+        tasks[i] = (task_t){.exec = &count_run, .frequency = _HZ(1000 * (i + 1)), .wake_on = WAKE_TIMER};
+}
+
+static void bench_scheduler(device_t *state) {
+    static task_t tasks[MAX_TASKS_PER_CORE];
+    static task_stats_t stats[MAX_TASKS_PER_CORE];
+    scheduler_t scheduler;
+    uint32_t passes = 0;
+
+    setup_scheduler_tasks(tasks);
+    scheduler_runs = 0;
+
+    uint64_t start = now_ns(), end = time_us_64() + SCHEDULER_RUN_US;
+
+    while (time_us_64() < end) {
+        for (int i = 0; i < MAX_TASKS_PER_CORE; i++) {
+            uint64_t current_time = time_us_64();
+
+            if (current_time < tasks[i].next_run)
+                continue;
+
+            tasks[i].next_run = current_time + tasks[i].frequency;
+            tasks[i].exec(state);
+        }
+
+        passes++;
+    }
+
+    printf("scheduler, old loop      %7.1f ns/run, %6u runs, %8u passes, awake 100 %%\n",
+           (double)(now_ns() - start) / scheduler_runs, scheduler_runs, passes);
+
+    setup_scheduler_tasks(tasks);
+    scheduler_init(&scheduler, tasks, MAX_TASKS_PER_CORE, stats);
+    scheduler_runs = passes = 0;
+
+    uint64_t slept_us = host_usb.slept_us;
+    start = now_ns();
+    end   = time_us_64() + SCHEDULER_RUN_US;
+
+    while (time_us_64() < end) {
+        task_scheduler(state, &scheduler);
+        passes++;
+    }
+
+    uint64_t elapsed_ns = now_ns() - start, awake_ns = elapsed_ns - (host_usb.slept_us - slept_us) * 1000;
+    uint32_t overruns = 0;
+
+    for (int i = 0; i < MAX_TASKS_PER_CORE; i++)
+        overruns += tasks[i].overruns;
+
+    printf("scheduler, deadline heap %7.1f ns/run, %6u runs, %8u passes, awake %5.1f %%, %u periods skipped\n",
+           (double)awake_ns / scheduler_runs, scheduler_runs, passes, awake_ns * 100.0 / elapsed_ns, overruns);
+}
+
+/* queue_t the way the pico-sdk implements it: every add and remove takes a hardware spinlock with
+   interrupts off, the indexes wrap by comparison against element_count + 1 slots and unlocking
+   sends an event. Kept here as the reference the lock-free ring replaced. */
+#define RING_ITEMS     16
+#define RING_TRANSFERS 2000000
+
+typedef struct {
+    uint32_t seq;
+    uint32_t fill[7];
+} ring_item_t;
+
+typedef struct {
+    volatile uint8_t lock;
+    uint16_t element_count;
+    uint16_t rptr, wptr;
+    ring_item_t items[RING_ITEMS + 1];
+} spinlock_queue_t;
+
+static uint32_t queue_lock(spinlock_queue_t *q) {
+    uint32_t save = save_and_disable_interrupts();
+
+    while (__atomic_test_and_set(&q->lock, __ATOMIC_ACQUIRE))
+        ;
+    return save;
+}
+
+static void queue_unlock(spinlock_queue_t *q, uint32_t save) {
+    __atomic_clear(&q->lock, __ATOMIC_RELEASE);
+    __sev();
+    restore_interrupts(save);
+}
+
+static uint16_t queue_level(spinlock_queue_t *q) {
+    int32_t level = (int32_t)q->wptr - (int32_t)q->rptr;
+    return level < 0 ? level + q->element_count + 1 : level;
+}
+
+static uint16_t queue_next(spinlock_queue_t *q, uint16_t index) {
+    return ++index > q->element_count ? 0 : index;
+}
+
+static bool queue_add(spinlock_queue_t *q, const ring_item_t *item) {
+    uint32_t save = queue_lock(q);
+    bool added    = queue_level(q) != q->element_count;
+
+    if (added) {
+        memcpy(&q->items[q->wptr], item, sizeof(ring_item_t));
+        q->wptr = queue_next(q, q->wptr);
+    }
+
+    queue_unlock(q, save);
+    return added;
+}
+
+static bool queue_remove(spinlock_queue_t *q, ring_item_t *item) {
+    uint32_t save = queue_lock(q);
+    bool removed  = queue_level(q) != 0;
+
+    if (removed) {
+        memcpy(item, &q->items[q->rptr], sizeof(ring_item_t));
+        q->rptr = queue_next(q, q->rptr);
+    }
+
+    queue_unlock(q, save);
+    return removed;
+}
+
+static RING_T(ring_item_t, RING_ITEMS) bench_ring;
+static spinlock_queue_t bench_queue = {.element_count = RING_ITEMS};
+
+/* Each item carries its sequence number and a pattern derived from it, a torn or reordered copy shows */
+static void make_item(ring_item_t *item, uint32_t seq) {
+    item->seq = seq;
+    for (int i = 0; i < 7; i++)
+        item->fill[i] = seq * 2654435761u + i;
+}
+
+static bool item_ok(const ring_item_t *item, uint32_t seq) {
+    ring_item_t expected;
+    make_item(&expected, seq);
+    return !memcmp(item, &expected, sizeof(expected));
+}
+
+static void *ring_producer(void *arg) {
+    ring_item_t item;
+
+    for (uint32_t seq = 0; seq < RING_TRANSFERS; seq++) {
+        make_item(&item, seq);
+        while (!ring_try_add(&bench_ring.ring, &item))
+            sched_yield();
+    }
+    return NULL;
+}
+
+static void *queue_producer(void *arg) {
+    ring_item_t item;
+
+    for (uint32_t seq = 0; seq < RING_TRANSFERS; seq++) {
+        make_item(&item, seq);
+        while (!queue_add(&bench_queue, &item))
+            sched_yield();
+    }
+    return NULL;
+}
+
+/* Producer on its own thread, the consumer here checks that every item arrives once, in order and whole */
+static void bench_ring_threads(void) {
+    pthread_t producer;
+    uint32_t bad  = 0;
+    uint64_t start = now_ns();
+
+    ring_init(&bench_ring);
+    pthread_create(&producer, NULL, ring_producer, NULL);
+
+    for (uint32_t seq = 0; seq < RING_TRANSFERS; seq++) {
+        ring_item_t *item;
+
+        while (!(item = ring_peek(&bench_ring.ring)))
+            sched_yield();
+
+        bad += !item_ok(item, seq);
+        ring_pop(&bench_ring.ring);
+    }
+
+    pthread_join(producer, NULL);
+    printf("ring, two threads        %8.1f ns/item, %u items, %u bad\n",
+           (double)(now_ns() - start) / RING_TRANSFERS, RING_TRANSFERS, bad);
+
+    bad   = 0;
+    start = now_ns();
+    pthread_create(&producer, NULL, queue_producer, NULL);
+
+    for (uint32_t seq = 0; seq < RING_TRANSFERS; seq++) {
+        ring_item_t item;
+
+        while (!queue_remove(&bench_queue, &item))
+            sched_yield();
+
+        bad += !item_ok(&item, seq);
+    }
+
+    pthread_join(producer, NULL);
+    printf("queue_t, two threads     %8.1f ns/item, %u items, %u bad\n",
+           (double)(now_ns() - start) / RING_TRANSFERS, RING_TRANSFERS, bad);
+}
+
+/* Add and remove on one thread, the cost of the operations themselves without any waiting */
+static void bench_ring_ops(void) {
+    ring_item_t item, out;
+    uint64_t start = now_ns();
+
+    make_item(&item, 0);
+    ring_init(&bench_ring);
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        ring_try_add(&bench_ring.ring, &item);
+        memcpy(&out, ring_peek(&bench_ring.ring), sizeof(out));
+        ring_pop(&bench_ring.ring);
+    }
+
+    report("ring, add + remove", now_ns() - start, ITERATIONS);
+    start = now_ns();
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        queue_add(&bench_queue, &item);
+        queue_remove(&bench_queue, &out);
+    }
+
+    report("queue_t, add + remove", now_ns() - start, ITERATIONS);
+}
+
+/* Alternate between a key press and release, so every report is a change */
+static void bench_keyboard(device_t *state) {
+    uint8_t raw[KBD_REPORT_LENGTH] = {0};
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        raw[2] = (i & 1) ? HID_KEY_A + (i & 0xF) : HID_KEY_NONE;
+
+        process_keyboard_report(raw, sizeof(raw), 0, &keyboard_iface);
+        process_kbd_queue_task(state);
+    }
+
+    report("keyboard", now_ns() - start, ITERATIONS);
+}
+
+/* Packets from the other board, received in bursts the way they pile up in the DMA ring.
+   Only the receiver is timed, writing the frames in stands in for the DMA. */
+static void bench_uart_receive(device_t *state) {
+    uint8_t frames[UART_RX_BUDGET][RAW_PACKET_LENGTH];
+    uint64_t elapsed = 0;
+
+    for (int i = 0; i < UART_RX_BUDGET; i++) {
+        uart_packet_t packet = {.type = MOUSE_ZOOM_MSG, .data = {i & 1}};
+        write_raw_packet(frames[i], &packet);
+    }
+
+    for (int i = 0; i < ITERATIONS / UART_RX_BUDGET; i++) {
+        host_uart_receive(state, frames, sizeof(frames));
+
+        uint64_t start = now_ns();
+        packet_receiver_task(state);
+        elapsed += now_ns() - start;
+    }
+
+    report("uart receive", elapsed, ITERATIONS / UART_RX_BUDGET * UART_RX_BUDGET);
+}
+
+/* Keeps the TX queue full and runs the TX task once per simulated loop pass, with the DMA taking as
+   long as the line would at SERIAL_BAUDRATE. Reports packets/s against what the line can carry. */
+static void bench_uart_transmit(device_t *state, uint32_t pass_us) {
+    queued_uart_packet_t packet = {.packet.type = MOUSE_ZOOM_MSG};
+    ring_t *queue = &state->uart_tx_queue[0][UART_LANE_INPUT].ring;
+    uint32_t start_bytes = host_usb.uart_bytes;
+    uint64_t start = time_us_64(), end = start + 200000;
+
+    host_usb.uart_baud = SERIAL_BAUDRATE;
+
+    while (time_us_64() < end) {
+        while (ring_try_add(queue, &packet))
+            ;
+
+        process_uart_tx_task(state);
+
+        for (uint64_t next = time_us_64() + pass_us; time_us_64() < next;)
+            ;
+    }
+
+    /* Drop what's still queued, send what was already taken and wait for the line to go idle */
+    while (ring_peek(queue))
+        ring_pop(queue);
+
+    while (state->uart_tx_staged || dma_channel_is_busy(state->dma_tx_channel))
+        process_uart_tx_task(state);
+
+    host_usb.uart_baud = 0;
+
+    double line_rate = SERIAL_BAUDRATE / 10.0 / RAW_PACKET_LENGTH;
+    double seconds   = (time_us_64() - start) / 1e6;
+    double achieved  = (host_usb.uart_bytes - start_bytes) / RAW_PACKET_LENGTH / seconds;
+    char name[32];
+
+    snprintf(name, sizeof(name), "uart tx, %3u us/pass", pass_us);
+    printf("%-24s %8.0f packets/s, %5.1f %% of line rate (%.0f)\n", name, achieved, 100 * achieved / line_rate, line_rate);
+}
+
+/* Line noise on the link. Every group of frames gets one error event (a few flipped bits or a burst),
+   then goes through the same frame parser the receiver uses. A damaged frame that still comes out as
+   a packet, but not the one that was sent, is an error that got through. Both frame formats are fed the
+   same errors. */
+#define LINK_ERROR_EVENTS 200000
+#define LINK_ERROR_GROUP  8
+
+enum { ERR_1_BIT, ERR_2_BITS, ERR_3_BITS, ERR_BURST_16, NUM_ERROR_MODELS };
+
+static const char *error_model_names[NUM_ERROR_MODELS] = {
+    [ERR_1_BIT]    = "1 bit",
+    [ERR_2_BITS]   = "2 bits",
+    [ERR_3_BITS]   = "3 bits",
+    [ERR_BURST_16] = "burst <= 16 bits",
+};
+
+static uint32_t xorshift32(uint32_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+static void flip_bits(uint8_t *stream, uint32_t bits, int model, uint32_t *seed) {
+    uint32_t pos = xorshift32(seed) % bits;
+
+    switch (model) {
+        case ERR_BURST_16: {
+            /* First and last bit of the burst are wrong, the ones in between are random */
+            uint32_t length  = 2 + xorshift32(seed) % 15;
+            uint32_t pattern = xorshift32(seed) | 1 | (1u << (length - 1));
+
+            pos %= bits - length;
+            for (uint32_t i = 0; i < length; i++)
+                if (pattern & (1u << i))
+                    stream[(pos + i) / 8] ^= 1 << ((pos + i) % 8);
+            return;
+        }
+        default:
+            /* Distinct bits, in the same frame or close to it */
+            for (int i = 0; i <= model; i++) {
+                stream[pos / 8] ^= 1 << (pos % 8);
+                pos = (pos + 1 + xorshift32(seed) % 95) % bits;
+            }
+    }
+}
+
+static uint32_t link_error_run(device_t *state, bool long_frames, int model) {
+    uint32_t frame_length = long_frames ? LINK_FRAME_LENGTH(PACKET_DATA_LENGTH) : RAW_PACKET_LENGTH;
+    uint8_t stream[LINK_ERROR_GROUP * LINK_FRAME_LENGTH(PACKET_DATA_LENGTH)];
+    uart_packet_t sent[LINK_ERROR_GROUP];
+    uint32_t seed = 0x12345678, undetected = 0;
+
+    /* Otherwise the regular frames would be refused after a run with long ones */
+    state->peer_long_frames = false;
+
+    for (uint32_t event = 0; event < LINK_ERROR_EVENTS; event++) {
+        uint32_t length = LINK_ERROR_GROUP * frame_length;
+
+        for (uint32_t i = 0; i < LINK_ERROR_GROUP; i++) {
+            sent[i] = (uart_packet_t){.type = MOUSE_REPORT_MSG, .data32 = {event * LINK_ERROR_GROUP + i, xorshift32(&seed)}};
+
+            if (long_frames) {
+                queued_link_packet_t item = {.len = PACKET_DATA_LENGTH, .packet.type = sent[i].type};
+                memcpy(item.packet.data, sent[i].data, PACKET_DATA_LENGTH);
+                write_raw_link_packet(&stream[i * frame_length], &item);
+            } else {
+                write_raw_packet(&stream[i * frame_length], &sent[i]);
+            }
+        }
+
+        flip_bits(stream, length * 8, model, &seed);
+        host_uart_receive(state, stream, length);
+
+        /* Same parsing as packet_receiver_task(), minus the dispatch */
+        for (uint32_t delta = length; delta >= RAW_PACKET_LENGTH;) {
+            uint32_t start = state->dma_ptr, frame = get_frame_length(state);
+
+            if (frame > delta)
+                break;
+
+            if (!frame) {
+                state->dma_ptr = NEXT_RING_IDX(state->dma_ptr);
+                delta--;
+                continue;
+            }
+
+            uart_packet_t *packet = fetch_packet(state, frame);
+            delta -= (state->dma_ptr - start) & (DMA_RX_BUFFER_SIZE - 1);
+
+            if (!packet)
+                continue;
+
+            uint32_t index = packet->data32[0] - event * LINK_ERROR_GROUP;
+
+            if (frame != frame_length || index >= LINK_ERROR_GROUP
+                || memcmp(packet, &sent[index], TYPE_LENGTH + PACKET_DATA_LENGTH))
+                undetected++;
+        }
+
+        /* Whatever is left of this group is dropped, the next one starts clean */
+        state->dma_ptr = DMA_RX_BUFFER_SIZE - dma_channel_hw_addr(state->dma_rx_channel)->transfer_count;
+    }
+
+    return undetected;
+}
+
+static void bench_link_errors(device_t *state) {
+    printf("%-24s %12s %12s   (of %u error events)\n", "link errors let through", "xor", "crc16", LINK_ERROR_EVENTS);
+
+    for (int model = 0; model < NUM_ERROR_MODELS; model++) {
+        uint32_t xor = link_error_run(state, false, model);
+        uint32_t crc = link_error_run(state, true, model);
+
+        printf("  %-22s %12u %12u\n", error_model_names[model], xor, crc);
+    }
+}
+
+/* Bulk lane kept full, like during a firmware copy, while a key goes out every millisecond.
+   Reports how long the keys waited to be put on the wire and how much of the line bulk got. */
+static void bench_uart_priority(device_t *state, uint32_t pass_us) {
+    uart_packet_t bulk = {.type = REQUEST_BYTE_MSG}, key = {.type = KEYBOARD_REPORT_MSG};
+    ring_t *queue = &state->uart_tx_queue[0][UART_LANE_BULK].ring;
+    ring_t *keys_queue = &state->uart_tx_queue[0][UART_LANE_INPUT].ring;
+    uart_lane_stats_t *stats = &state->uart_tx_lane_stats[UART_LANE_INPUT];
+    uint32_t start_bytes = host_usb.uart_bytes, keys = 0;
+    bool key_waiting = false;
+    uint64_t latency_sum = 0, start = time_us_64(), end = start + 200000, next_key = start;
+
+    host_usb.uart_baud = SERIAL_BAUDRATE;
+    *stats = (uart_lane_stats_t){0};
+
+    while (time_us_64() < end) {
+        while (queue_uart_packet(state, &bulk))
+            ;
+
+        if (time_us_64() >= next_key) {
+            queue_uart_packet(state, &key);
+            next_key += 1000;
+            key_waiting = true;
+            keys++;
+        }
+
+        process_uart_tx_task(state);
+
+        /* Neither queued nor staged means its transfer just started */
+        if (key_waiting && !ring_level(keys_queue) && !(state->uart_tx_lanes_staged & (1 << UART_LANE_INPUT))) {
+            latency_sum += stats->latency_us;
+            key_waiting = false;
+        }
+
+        for (uint64_t next = time_us_64() + pass_us; time_us_64() < next;)
+            ;
+    }
+
+    while (ring_peek(queue))
+        ring_pop(queue);
+
+    while (state->uart_tx_staged || dma_channel_is_busy(state->dma_tx_channel))
+        process_uart_tx_task(state);
+
+    host_usb.uart_baud = 0;
+
+    double seconds = (time_us_64() - start) / 1e6;
+    double bulk_rate = (host_usb.uart_bytes - start_bytes) / RAW_PACKET_LENGTH / seconds - keys / seconds;
+    char name[32];
+
+    snprintf(name, sizeof(name), "uart keys+bulk, %3u us", pass_us);
+    printf("%-24s key wait avg %5.1f max %4u us, bulk %5.1f %% of line rate\n", name, (double)latency_sum / keys,
+           stats->latency_max_us, 100 * bulk_rate / (SERIAL_BAUDRATE / 10.0 / RAW_PACKET_LENGTH));
+}
+
+/* Absolute mouse at rate_hz, going around in small circles, against a link kept busy with bulk packets.
+   The other board announces peer_version, from 4 on the positions that can't go out right away are
+   packed into MOUSE_TRAIL_MSG frames instead of merged. */
+static void bench_mouse_trail(device_t *state, uint32_t rate_hz, uint8_t peer_version) {
+    uart_packet_t bulk = {.type = REQUEST_BYTE_MSG}, packet = {.type = MOUSE_REPORT_MSG};
+    mouse_report_t *mouse = (mouse_report_t *)packet.data;
+    ring_t *queue = &state->uart_tx_queue[0][UART_LANE_BULK].ring;
+    uint32_t start_bytes = host_usb.uart_bytes, positions = 0;
+    uint64_t start = time_us_64(), end = start + 200000, next_mouse = start;
+
+    host_usb.uart_baud = SERIAL_BAUDRATE;
+    state->uart_tx_mouse_merged = state->uart_tx_mouse_packed = 0;
+    *mouse = (mouse_report_t){.mode = ABSOLUTE, .x = MAX_SCREEN_COORD / 2, .y = MAX_SCREEN_COORD / 2};
+
+    while (time_us_64() < end) {
+        state->peer_link_version = peer_version;
+        state->peer_heartbeat_us = time_us_64();
+
+        while (queue_uart_packet(state, &bulk))
+            ;
+
+        if (time_us_64() >= next_mouse) {
+            mouse->x += (positions & 16) ? -5 : 5;
+            mouse->y += (positions & 8) ? -3 : 3;
+            queue_uart_packet(state, &packet);
+            next_mouse += 1000000 / rate_hz;
+            positions++;
+        }
+
+        process_uart_tx_task(state);
+
+        for (uint64_t next = time_us_64() + 20; time_us_64() < next;)
+            ;
+    }
+
+    while (ring_peek(queue))
+        ring_pop(queue);
+
+    while (state->uart_tx_mouse_valid || state->uart_tx_staged || dma_channel_is_busy(state->dma_tx_channel))
+        process_uart_tx_task(state);
+
+    host_usb.uart_baud = 0;
+    state->peer_link_version = 0;
+
+    double seconds = (time_us_64() - start) / 1e6;
+    uint32_t delivered = positions - state->uart_tx_mouse_merged;
+    char name[32];
+
+    snprintf(name, sizeof(name), "mouse %u Hz, link v%u", rate_hz, peer_version);
+    printf("%-24s %5.1f %% of positions delivered, %u as deltas, %.0f bytes/s on the line\n", name,
+           100.0 * delivered / positions, state->uart_tx_mouse_packed, (host_usb.uart_bytes - start_bytes) / seconds);
+}
+
+/* Something closer to a real image than zeros for the firmware copy to compress. The whole 188 kB code
+   region is filled with code, our own (x86-64 rather than Thumb-2) repeated as needed, which is the worst
+   case since a real build leaves part of it erased. Then the FAT disk image and the metadata sector. */
+#define FW_CODE_REGION (188 * 1024)
+
+extern const uint8_t __executable_start[], etext[];
+
+static void load_fw_image(void) {
+    FILE *disk = fopen(DH_DISK_IMAGE, "rb");
+    size_t code_len = FW_CODE_REGION, disk_len = 0;
+
+    memset(host_fw_image, 0xff, STAGING_IMAGE_SIZE);
+
+    for (size_t i = 0; i < FW_CODE_REGION; i++)
+        host_fw_image[i] = __executable_start[i % (etext - __executable_start)];
+
+    if (disk) {
+        disk_len = fread(&host_fw_image[FW_CODE_REGION], 1, STAGING_IMAGE_SIZE - FW_CODE_REGION - FLASH_SECTOR_SIZE, disk);
+        fclose(disk);
+    }
+
+    uint32_t compressed[2] = {0};
+    uint8_t out[FLASH_PAGE_SIZE];
+
+    for (uint32_t page = 0; page < STAGING_PAGES_CNT; page++) {
+        uint32_t length = compress_page(&host_fw_image[page * FLASH_PAGE_SIZE], out);
+        compressed[page * FLASH_PAGE_SIZE >= FW_CODE_REGION] += length ? length : FLASH_PAGE_SIZE;
+    }
+
+    printf("fw image: %zu kB code compresses to %u kB, rest (%zu kB disk) to %u kB\n", code_len / 1024,
+           compressed[0] / 1024, disk_len / 1024, compressed[1] / 1024);
+}
+
+/* Firmware copy between boards, looped back: our own requests come back to us, get answered from our
+   own image and the answers come back again. A transfer arrives once the line would have sent it, and
+   the upgrade task runs at 4 kHz at most, like it's scheduled on the board. Stops after limit bytes.
+   With damage_every, one bit is flipped in every that many transfers. */
+#define FW_TASK_INTERVAL_US 250
+
+static void bench_fw_transfer(device_t *state, const char *name, uint8_t peer_version, uint32_t limit,
+                              uint32_t damage_every) {
+    uart_packet_t heartbeat = {.type = HEARTBEAT_MSG, .data16[0] = UINT16_MAX};
+    const capture_record_t *record;
+    capture_t link = {0};
+    size_t offset = 0;
+    uint32_t transfers = 0;
+    uint64_t last_run = 0;
+
+    host_usb.uart_baud = SERIAL_BAUDRATE;
+    host_usb.output    = &link;
+    heartbeat.data[6]  = peer_version;
+
+    /* Other board announces a newer version, which starts the upgrade */
+    handle_heartbeat_msg(&heartbeat, state);
+
+    while (state->fw.upgrade_in_progress && state->fw.address < limit) {
+        /* The other board keeps sending heartbeats, we stop while upgrading */
+        state->peer_heartbeat_us = time_us_64();
+
+        if (!dma_channel_is_busy(state->dma_tx_channel)) {
+            while ((record = capture_next(&link, &offset))) {
+                uint8_t data[DMA_TX_BUFFER_SIZE];
+
+                memcpy(data, record + 1, record->len);
+
+                if (damage_every && ++transfers % damage_every == 0)
+                    data[record->len / 2] ^= 0x10;
+
+                host_uart_receive(state, data, record->len);
+            }
+        }
+
+        packet_receiver_task(state);
+
+        if ((state->fw.byte_done || time_us_64() - last_run >= FW_PAGE_TIMEOUT_US)
+            && time_us_64() - last_run >= FW_TASK_INTERVAL_US) {
+            last_run = time_us_64();
+            firmware_upgrade_task(state);
+        }
+
+        flash_writer_task(state);
+        process_uart_tx_task(state);
+    }
+
+    uint32_t elapsed_us = time_us_32() - state->fw.started_us, bytes = state->fw.address;
+    uint32_t retransmits = state->fw.retransmits;
+
+    /* Let whatever is still in flight go through with the upgrade stopped */
+    state->fw = (fw_upgrade_state_t){0};
+    wait_for_flash(state);
+
+    for (int pass = 0; pass < 1000; pass++) {
+        if (!dma_channel_is_busy(state->dma_tx_channel))
+            while ((record = capture_next(&link, &offset)))
+                host_uart_receive(state, record + 1, record->len);
+
+        packet_receiver_task(state);
+        process_uart_tx_task(state);
+    }
+
+    host_usb.output    = NULL;
+    host_usb.uart_baud = 0;
+    state->fw          = (fw_upgrade_state_t){0};
+    state->peer_link_version = 0;
+    state->reboot_requested  = false;
+    capture_free(&link);
+
+    printf("%-24s %4u KB in %7.1f ms, %6.1f KB/s, whole image %5.2f s, %u pages resent\n", name, bytes / 1024,
+           elapsed_us / 1e3, bytes / 1024.0 / (elapsed_us / 1e6), (double)elapsed_us * STAGING_IMAGE_SIZE / bytes / 1e6,
+           retransmits);
+}
+
+/* Sends what the line has finished transmitting to the other board */
+static void forward_link(device_t *state, capture_t *link, size_t *offset, int fd) {
+    const capture_record_t *record;
+
+    if (dma_channel_is_busy(state->dma_tx_channel))
+        return;
+
+    while ((record = capture_next(link, offset)))
+        if (write(fd, record + 1, record->len) != record->len)
+            exit(1);
+}
+
+/* Takes whatever the other board sent, waiting up to wait_us for it. Returns false once it's gone. */
+static bool receive_link(device_t *state, int fd, uint32_t wait_us) {
+    struct timeval timeout = {.tv_usec = wait_us};
+    uint8_t data[DMA_RX_BUFFER_SIZE / 2];
+    fd_set fds;
+
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+
+    if (select(fd + 1, &fds, NULL, NULL, &timeout) <= 0)
+        return true;
+
+    ssize_t len = read(fd, data, sizeof(data));
+
+    if (len > 0)
+        host_uart_receive(state, data, len);
+
+    return len > 0;
+}
+
+static uint32_t link_wait_us(device_t *state, uint32_t limit_us) {
+    uint64_t now = time_us_64();
+
+    if (now < host_usb.uart_busy_until && host_usb.uart_busy_until - now < limit_us)
+        return host_usb.uart_busy_until - now;
+
+    return limit_us;
+}
+
+/* The other board, running new_image, answers our requests until we hang up */
+static void run_fw_sender(device_t *state, const uint8_t *new_image, int rx, int tx) {
+    capture_t link = {0};
+    size_t offset = 0;
+
+    memcpy(host_fw_image, new_image, STAGING_IMAGE_SIZE);
+    state->sector_crcs = (sector_crcs_t){0};
+    host_usb.output = &link;
+
+    while (receive_link(state, rx, link_wait_us(state, FW_TASK_INTERVAL_US))) {
+        packet_receiver_task(state);
+        firmware_upgrade_task(state);
+        flash_writer_task(state);
+        process_uart_tx_task(state);
+        forward_link(state, &link, &offset, tx);
+    }
+
+    _exit(0);
+}
+
+/* Two boards this time, the other one is forked off with a different image and they talk over pipes.
+   We start from old_image and copy new_image from it, the copy has to match and pass its checksum. */
+static void bench_fw_update(device_t *state, const char *name, uint8_t peer_version, const uint8_t *old_image,
+                            const uint8_t *new_image) {
+    uart_packet_t heartbeat = {.type = HEARTBEAT_MSG, .data16[0] = UINT16_MAX};
+    int to_sender[2], from_sender[2];
+    capture_t link = {0};
+    size_t offset = 0;
+    uint64_t last_run = 0;
+
+    if (pipe(to_sender) || pipe(from_sender))
+        exit(1);
+
+    host_usb.uart_baud = SERIAL_BAUDRATE;
+    fflush(stdout);
+
+    pid_t sender = fork();
+
+    if (sender == 0) {
+        close(to_sender[1]);
+        close(from_sender[0]);
+        run_fw_sender(state, new_image, to_sender[0], from_sender[1]);
+    }
+
+    close(to_sender[0]);
+    close(from_sender[1]);
+
+    /* The image changed without the flash writer, so the sector CRCs we know are stale */
+    memcpy(host_fw_image, old_image, STAGING_IMAGE_SIZE);
+    state->sector_crcs = (sector_crcs_t){0};
+    host_usb.flash_writable = true;
+    host_usb.output   = &link;
+    heartbeat.data[6] = peer_version;
+    handle_heartbeat_msg(&heartbeat, state);
+
+    while (state->fw.upgrade_in_progress) {
+        state->peer_heartbeat_us = time_us_64();
+
+        if (!receive_link(state, from_sender[0], link_wait_us(state, FW_TASK_INTERVAL_US)))
+            break;
+
+        packet_receiver_task(state);
+
+        if ((state->fw.byte_done || time_us_64() - last_run >= FW_PAGE_TIMEOUT_US)
+            && time_us_64() - last_run >= FW_TASK_INTERVAL_US) {
+            last_run = time_us_64();
+            firmware_upgrade_task(state);
+        }
+
+        flash_writer_task(state);
+        process_uart_tx_task(state);
+        forward_link(state, &link, &offset, to_sender[1]);
+    }
+
+    close(to_sender[1]);
+    close(from_sender[0]);
+    waitpid(sender, NULL, 0);
+
+    bool copied = state->reboot_requested && !memcmp(host_fw_image, new_image, STAGING_IMAGE_SIZE);
+
+    printf("%-24s %s in %7.1f ms, %3u of %u pages skipped, %u pages resent\n", name, copied ? "copied" : "FAILED",
+           state->fw.transfer_us / 1e3, state->fw.skipped_pages, STAGING_PAGES_CNT, state->fw.retransmits);
+
+    host_usb.output    = NULL;
+    host_usb.uart_baud = 0;
+    host_usb.flash_writable = false;
+    state->fw          = (fw_upgrade_state_t){0};
+    state->peer_link_version = 0;
+    state->reboot_requested  = false;
+    capture_free(&link);
+}
+
+/* Same firmware rebuilt with a small change, once patched in place and once with code added, which
+   moves everything after it. The metadata sector changes with every build. */
+static void bench_fw_delta(device_t *state) {
+    static uint8_t old_image[STAGING_IMAGE_SIZE], patched[STAGING_IMAGE_SIZE], grown[STAGING_IMAGE_SIZE];
+    uint32_t change = FW_CODE_REGION * 2 / 5, added = 64;
+
+    memcpy(old_image, host_fw_image, STAGING_IMAGE_SIZE);
+    memcpy(patched, old_image, STAGING_IMAGE_SIZE);
+    memcpy(grown, old_image, STAGING_IMAGE_SIZE);
+
+    for (int i = 0; i < 4; i++)
+        patched[change + i] ^= 0x5a;
+
+    memmove(&grown[change + added], &old_image[change], FW_CODE_REGION - change - added);
+    memset(&grown[change], 0x00, added);
+
+    patched[STAGING_IMAGE_SIZE - FLASH_SECTOR_SIZE]++;
+    grown[STAGING_IMAGE_SIZE - FLASH_SECTOR_SIZE]++;
+
+    bench_fw_update(state, "fw update, patched", LINK_VERSION_FW_LZ, old_image, patched);
+    bench_fw_update(state, "fw update, patched, delta", LINK_VERSION_FW_DELTA, old_image, patched);
+    bench_fw_update(state, "fw update, grown", LINK_VERSION_FW_LZ, old_image, grown);
+    bench_fw_update(state, "fw update, grown, delta", LINK_VERSION_FW_DELTA, old_image, grown);
+
+    memcpy(host_fw_image, old_image, STAGING_IMAGE_SIZE);
+}
+
+/* CRC32 of the image the way the firmware checks it, byte at a time against what crc32_update()
+   uses here. On the board that's the DMA sniffer, which can't be timed on the host. */
+#define CRC_PASSES 20
+
+static void bench_crc32(void) {
+    const size_t length = STAGING_IMAGE_SIZE - FLASH_SECTOR_SIZE;
+    uint32_t byte_crc = 0, crc = 0;
+    uint64_t start = now_ns();
+
+    for (int pass = 0; pass < CRC_PASSES; pass++) {
+        byte_crc = 0xffffffff;
+
+        for (size_t i = 0; i < length; i++)
+            byte_crc = crc32_iter(byte_crc, host_fw_image[i]);
+    }
+
+    uint64_t byte_ns = now_ns() - start;
+    start = now_ns();
+
+    for (int pass = 0; pass < CRC_PASSES; pass++)
+        crc = calculate_firmware_crc32();
+
+    uint64_t update_ns = now_ns() - start;
+
+    printf("crc32, byte table       %7.1f MB/s\n", length * CRC_PASSES * 1e3 / byte_ns);
+    printf("crc32, slice-by-8       %7.1f MB/s, %s\n", length * CRC_PASSES * 1e3 / update_ns,
+           crc == ~byte_crc && calc_crc32((const uint8_t *)"123456789", 9) == 0xcbf43926 ? "same CRC" : "CRC MISMATCH");
+}
+
+/* Mouse moves at 1 kHz and the config is saved in the middle, the longest gap between reports reaching
+   the host is how long input stalls. The shim keeps the chip busy for the W25Q16JV datasheet typicals,
+   45 ms per sector erase and 0.4 ms per page. Blocking waits for the write like save_config() used to. */
+#define SAVE_AT_US  50000
+#define SAVE_RUN_US 200000
+
+static void bench_config_save(device_t *state, const char *name, bool background) {
+    uint8_t raw[7] = {0};
+    uint32_t reports = host_usb.hid_reports, max_gap = 0;
+    uint64_t start = time_us_64(), last_report = start, next_move = start;
+    bool saved = false;
+
+    host_usb.flash_erase_us   = 45000;
+    host_usb.flash_program_us = 400;
+
+    while (time_us_64() - start < SAVE_RUN_US) {
+        if (time_us_64() >= next_move) {
+            int16_t move = (next_move / 1000 & 1) ? 5 : -5;
+
+            memcpy(&raw[1], &move, sizeof(move));
+            memcpy(&raw[3], &move, sizeof(move));
+            process_mouse_report(raw, sizeof(raw), 0, &mouse_iface);
+            next_move += 1000;
+        }
+
+        if (!saved && time_us_64() - start >= SAVE_AT_US) {
+            saved = true;
+
+            if (background)
+                save_config(state);
+            else
+                write_flash_page((uint32_t)ADDR_CONFIG - XIP_BASE, state->page_buffer);
+        }
+
+        process_mouse_queue_task(state);
+        flash_writer_task(state);
+
+        if (host_usb.hid_reports != reports) {
+            uint64_t now = time_us_64();
+
+            if (now - last_report > max_gap)
+                max_gap = now - last_report;
+
+            reports     = host_usb.hid_reports;
+            last_report = now;
+        }
+    }
+
+    wait_for_flash(state);
+    host_usb.flash_erase_us   = 0;
+    host_usb.flash_program_us = 0;
+
+    printf("%-24s max input stall %6.1f ms\n", name, max_gap / 1e3);
+}
+
+static void bench_descriptor(void) {
+    hid_interface_t iface;
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < ITERATIONS / 10; i++) {
+        memset(&iface, 0, sizeof(iface));
+        parse_report_descriptor(&iface, host_mouse_descriptor, host_mouse_descriptor_len);
+    }
+
+    report("descriptor parse", now_ns() - start, ITERATIONS / 10);
+}
+
+int main(void) {
+    device_t *state = &global_state;
+
+    host_init(state);
+
+    /* Start in the middle of the screen, away from the edges that switch outputs */
+    state->pointer_x = MAX_SCREEN_COORD / 2;
+    state->pointer_y = MAX_SCREEN_COORD / 2;
+
+    setup_interface(&mouse_iface, host_mouse_descriptor, host_mouse_descriptor_len);
+    setup_interface(&keyboard_iface, host_keyboard_descriptor, host_keyboard_descriptor_len);
+
+    if (!mouse_iface.mouse.is_found || !keyboard_iface.keyboard.is_found) {
+        fprintf(stderr, "Descriptor parsing failed\n");
+        return 1;
+    }
+
+    bench_acceleration(state);
+    bench_scheduler(state);
+    bench_ring_ops();
+    bench_ring_threads();
+    bench_mouse(state);
+    bench_keyboard(state);
+    bench_uart_receive(state);
+    bench_uart_transmit(state, 0);
+    bench_uart_transmit(state, 20);
+    bench_uart_transmit(state, 100);
+    bench_uart_priority(state, 0);
+    bench_uart_priority(state, 20);
+    bench_uart_priority(state, 100);
+    bench_mouse_trail(state, 1000, LINK_VERSION_LONG);
+    bench_mouse_trail(state, 1000, LINK_VERSION_MOUSE_TRAIL);
+    bench_mouse_trail(state, 8000, LINK_VERSION_LONG);
+    bench_mouse_trail(state, 8000, LINK_VERSION_MOUSE_TRAIL);
+    bench_descriptor();
+    bench_config_save(state, "config save, blocking", false);
+    bench_config_save(state, "config save, background", true);
+    load_fw_image();
+    bench_crc32();
+    bench_fw_transfer(state, "fw copy, 4 B requests", 0, STAGING_IMAGE_SIZE / 8, 0);
+    bench_fw_transfer(state, "fw copy, 32 B requests", LINK_VERSION_FW_PAGES - 1, STAGING_IMAGE_SIZE, 0);
+    bench_fw_transfer(state, "fw copy, paged", LINK_VERSION_FW_PAGES, STAGING_IMAGE_SIZE, 0);
+    bench_fw_transfer(state, "fw copy, paged, damaged", LINK_VERSION_FW_PAGES, STAGING_IMAGE_SIZE, 100);
+    bench_fw_transfer(state, "fw copy, compressed", LINK_VERSION_FW_LZ, STAGING_IMAGE_SIZE, 0);
+    bench_fw_transfer(state, "fw copy, compr., damaged", LINK_VERSION_FW_LZ, STAGING_IMAGE_SIZE, 100);
+    bench_fw_delta(state);
+    bench_link_errors(state);
+
+    printf("%u reports sent to host, %u bytes over UART\n", host_usb.hid_reports, host_usb.uart_bytes);
+    return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "capture.h"
+
+static void capture_reserve(capture_t *capture, size_t needed) {
+    if (capture->size + needed <= capture->capacity)
+        return;
+
+    while (capture->size + needed > capture->capacity)
+        capture->capacity = capture->capacity ? capture->capacity * 2 : 4096;
+
+    capture->data = realloc(capture->data, capture->capacity);
+
+    if (!capture->data) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+}
+
+void capture_append(capture_t *capture, const capture_record_t *record, const void *payload) {
+    capture_reserve(capture, sizeof(capture_record_t) + record->len);
+
+    memcpy(capture->data + capture->size, record, sizeof(capture_record_t));
+    memcpy(capture->data + capture->size + sizeof(capture_record_t), payload, record->len);
+
+    capture->size += sizeof(capture_record_t) + record->len;
+    capture->count++;
+}
+
+/* Returns the record at offset and moves offset past it, or NULL at the end. Payload follows the record. */
+const capture_record_t *capture_next(const capture_t *capture, size_t *offset) {
+    if (*offset + sizeof(capture_record_t) > capture->size)
+        return NULL;
+
+    const capture_record_t *record = (const capture_record_t *)(capture->data + *offset);
+
+    if (*offset + sizeof(capture_record_t) + record->len > capture->size)
+        return NULL;
+
+    *offset += sizeof(capture_record_t) + record->len;
+    return record;
+}
+
+bool capture_load(capture_t *capture, const char *path) {
+    capture_header_t header;
+    capture_record_t record;
+    uint8_t payload[CAPTURE_MAX_LEN];
+    FILE *file = fopen(path, "rb");
+
+    memset(capture, 0, sizeof(capture_t));
+
+    if (!file)
+        return false;
+
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != CAPTURE_MAGIC
+        || header.version != CAPTURE_VERSION) {
+        fclose(file);
+        return false;
+    }
+
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        if (record.len > CAPTURE_MAX_LEN || fread(payload, 1, record.len, file) != record.len)
+            break;
+
+        capture_append(capture, &record, payload);
+    }
+
+    fclose(file);
+    return true;
+}
+
+bool capture_save(const capture_t *capture, const char *path) {
+    capture_header_t header = {.magic = CAPTURE_MAGIC, .version = CAPTURE_VERSION};
+    FILE *file = fopen(path, "wb");
+
+    if (!file)
+        return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+              && fwrite(capture->data, 1, capture->size, file) == capture->size;
+
+    return (fclose(file) == 0) && ok;
+}
+
+void capture_free(capture_t *capture) {
+    free(capture->data);
+    memset(capture, 0, sizeof(capture_t));
+}
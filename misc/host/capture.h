@@ -0,0 +1,66 @@
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*==============================================================================
+ *  HID Capture Format
+ *
+ *  A file header followed by records, all little endian. Each record is a fixed
+ *  header and len bytes of payload. Inputs are the report descriptor of each
+ *  interface (sent once, when it mounts) and raw reports. Outputs are what the
+ *  firmware produced: reports to the PC and raw packets to the other board.
+ *==============================================================================*/
+
+#define CAPTURE_MAGIC   0x50414344 // "DCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_MAX_LEN 1024
+
+enum capture_type_e {
+    CAPTURE_DESCRIPTOR = 1, // Interface mounted, payload is the report descriptor
+    CAPTURE_REPORT     = 2, // Raw report received from a device
+    CAPTURE_HID_OUT    = 3, // Report sent to the PC, dev_addr holds the report ID
+    CAPTURE_UART_OUT   = 4, // Raw packet sent to the other board
+};
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+} capture_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t timestamp_us; // Time since the start of the capture
+    uint16_t len;          // Payload length
+    uint8_t type;          // One of capture_type_e
+    uint8_t dev_addr;      // USB device address
+    uint8_t instance;      // HID interface instance
+    uint8_t itf_protocol;  // HID_ITF_PROTOCOL_*, on descriptor records
+    uint8_t protocol;      // HID_PROTOCOL_BOOT or _REPORT, on descriptor records
+    uint8_t reserved;
+} capture_record_t;
+
+/* Capture held in memory, records and payloads packed one after another */
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    uint32_t count;
+} capture_t;
+
+void capture_append(capture_t *, const capture_record_t *, const void *payload);
+const capture_record_t *capture_next(const capture_t *, size_t *offset);
+bool capture_load(capture_t *, const char *path);
+bool capture_save(const capture_t *, const char *path);
+void capture_free(capture_t *);
@@ -0,0 +1,38 @@
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
+ */
+#include "host.h"
+
+/* Descriptors of a typical mouse and keyboard, for the benchmark and synthetic traces */
+
+/* Report protocol mouse: 5 buttons, 16-bit X/Y, wheel and AC pan, no report ID */
+const uint8_t host_mouse_descriptor[] = {
+    0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00,             // Desktop, Mouse, Pointer
+    0x05, 0x09, 0x19, 0x01, 0x29, 0x05, 0x15, 0x00, 0x25, 0x01,             // Buttons 1-5
+    0x95, 0x05, 0x75, 0x01, 0x81, 0x02, 0x95, 0x01, 0x75, 0x03, 0x81, 0x01, // ... and 3 bits padding
+    0x05, 0x01, 0x16, 0x01, 0x80, 0x26, 0xFF, 0x7F, 0x75, 0x10, 0x95, 0x02, // 2 x 16-bit
+    0x09, 0x30, 0x09, 0x31, 0x81, 0x06,                                     // X, Y relative
+    0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x01, 0x09, 0x38, 0x81, 0x06, // Wheel
+    0x05, 0x0C, 0x0A, 0x38, 0x02, 0x81, 0x06,                               // AC Pan
+    0xC0, 0xC0,
+};
+
+/* Keyboard with a boot compatible layout: modifiers, reserved byte, 6 keys */
+const uint8_t host_keyboard_descriptor[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07,                         // Desktop, Keyboard
+    0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, // Modifiers
+    0x81, 0x02, 0x95, 0x01, 0x75, 0x08, 0x81, 0x01,                         // Reserved
+    0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x26, 0xFF, 0x00,                   // 6 keys
+    0x05, 0x07, 0x19, 0x00, 0x2A, 0xFF, 0x00, 0x81, 0x00,
+    0xC0,
+};
+
+const int host_mouse_descriptor_len    = sizeof(host_mouse_descriptor);
+const int host_keyboard_descriptor_len = sizeof(host_keyboard_descriptor);
@@ -0,0 +1,46 @@
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
+ */
+#pragma once
+
+#include "main.h"
+#include "capture.h"
+
+/*==============================================================================
+ *  Host Build Hooks
+ *==============================================================================*/
+
+typedef struct {
+    uint32_t hid_reports; // Reports the device stack accepted for the host PC
+    uint32_t uart_bytes;  // Bytes handed to the UART TX DMA
+    bool hid_busy;        // While set, the HID endpoints are never ready
+    capture_t *output;    // When set, every report and UART packet sent is recorded here
+    uint64_t start_us;    // Output timestamps are relative to this
+    uint32_t uart_baud;   // When set, UART TX DMA stays busy for as long as the bytes take on the wire
+    uint64_t uart_busy_until;
+    bool flash_writable;  // When set, flash writes to the running image land in host_fw_image
+    uint32_t flash_erase_us;   // How long the chip stays busy after a sector erase command
+    uint32_t flash_program_us; // -||- page program command
+    uint64_t flash_busy_until;
+    uint64_t slept_us;         // Time spent in best_effort_wfe_or_timeout(), the scheduler's sleep
+} host_usb_t;
+
+extern host_usb_t host_usb;
+extern uint8_t host_fw_image[]; // Same memory as ADDR_FW_RUNNING, but writable
+
+extern const uint8_t host_mouse_descriptor[];
+extern const uint8_t host_keyboard_descriptor[];
+extern const int host_mouse_descriptor_len;
+extern const int host_keyboard_descriptor_len;
+
+void host_init(device_t *);
+void host_set_core(uint);
+void host_set_interface(uint8_t dev_addr, uint8_t instance, uint8_t itf_protocol, uint8_t protocol);
+void host_uart_receive(device_t *, const void *data, uint32_t len);
@@ -0,0 +1,25 @@
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
+ */
+#pragma once
+
+#include "pico.h"
+
+#define IO_QSPI_GPIO_QSPI_SS_CTRL_OEOVER_LSB  12
+#define IO_QSPI_GPIO_QSPI_SS_CTRL_OEOVER_BITS 0x00003000
+
+typedef struct {
+    struct {
+        volatile uint32_t status;
+        volatile uint32_t ctrl;
+    } io[6];
+} ioqspi_hw_t;
+
+extern ioqspi_hw_t *ioqspi_hw;
@@ -0,0 +1,25 @@
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
+ */
+#pragma once
+
+#include "pico.h"
+
+#define M0PLUS_SCR_SEVONPEND_BITS 0x00000010
+
+typedef struct {
+    volatile uint32_t cpuid;
+    volatile uint32_t icsr;
+    volatile uint32_t vtor;
+    volatile uint32_t aircr;
+    volatile uint32_t scr;
+} armv6m_scb_hw_t;
+
+extern armv6m_scb_hw_t *scb_hw;
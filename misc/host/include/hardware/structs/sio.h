@@ -0,0 +1,21 @@
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
+ */
+#pragma once
+
+#include "pico.h"
+
+typedef struct {
+    volatile uint32_t cpuid;
+    volatile uint32_t gpio_in;
+    volatile uint32_t gpio_hi_in;
+} sio_hw_t;
+
+extern sio_hw_t *sio_hw;
@@ -0,0 +1,29 @@
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
+ */
+#pragma once
+
+/* Host build shim for the pico-sdk basics. Addresses point into plain host memory. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+#define PICO_DEFAULT_LED_PIN 25
+#define PICO_ON_DEVICE 0
+
+extern uint8_t host_ppb[];
+
+#define XIP_BASE 0x10000000u
+#define PPB_BASE ((uintptr_t)host_ppb)
+
+uint get_core_num(void);
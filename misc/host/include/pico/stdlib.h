@@ -0,0 +1,24 @@
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
+ */
+#pragma once
+
+#include "pico.h"
+#include "hardware/gpio.h"
+
+uint32_t time_us_32(void);
+uint64_t time_us_64(void);
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+
+typedef uint64_t absolute_time_t;
+
+absolute_time_t from_us_since_boot(uint64_t us);
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp);
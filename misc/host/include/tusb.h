@@ -0,0 +1,212 @@
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
+ */
+#pragma once
+
+/* Host build shim: just the TinyUSB types, HID constants and calls the input pipeline uses.
+ * The device side is implemented in misc/host/shim.c and records what would be sent. */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TU_ATTR_PACKED __attribute__((packed))
+#define TU_BIT(n)      (1UL << (n))
+#define TU_U32_BYTE0(u32) ((uint8_t)((u32) & 0xFF))
+
+static inline uint16_t tu_u16(uint8_t high, uint8_t low) {
+    return (uint16_t)((high << 8) | low);
+}
+
+static inline uint32_t tu_u32(uint8_t b3, uint8_t b2, uint8_t b1, uint8_t b0) {
+    return ((uint32_t)b3 << 24) | ((uint32_t)b2 << 16) | ((uint32_t)b1 << 8) | b0;
+}
+
+/*==============================================================================
+ *  HID Reports
+ *==============================================================================*/
+
+typedef struct TU_ATTR_PACKED {
+    uint8_t modifier;
+    uint8_t reserved;
+    uint8_t keycode[6];
+} hid_keyboard_report_t;
+
+typedef struct TU_ATTR_PACKED {
+    uint8_t buttons;
+    int8_t x;
+    int8_t y;
+    int8_t wheel;
+    int8_t pan;
+} hid_mouse_report_t;
+
+enum {
+    HID_PROTOCOL_BOOT   = 0,
+    HID_PROTOCOL_REPORT = 1,
+};
+
+enum {
+    HID_ITF_PROTOCOL_NONE     = 0,
+    HID_ITF_PROTOCOL_KEYBOARD = 1,
+    HID_ITF_PROTOCOL_MOUSE    = 2,
+};
+
+typedef enum {
+    HID_REPORT_TYPE_INVALID = 0,
+    HID_REPORT_TYPE_INPUT,
+    HID_REPORT_TYPE_OUTPUT,
+    HID_REPORT_TYPE_FEATURE,
+} hid_report_type_t;
+
+/*==============================================================================
+ *  Report Descriptor Items
+ *==============================================================================*/
+
+enum { RI_TYPE_MAIN = 0, RI_TYPE_GLOBAL = 1, RI_TYPE_LOCAL = 2 };
+
+enum {
+    RI_MAIN_INPUT          = 8,
+    RI_MAIN_OUTPUT         = 9,
+    RI_MAIN_COLLECTION     = 10,
+    RI_MAIN_FEATURE        = 11,
+    RI_MAIN_COLLECTION_END = 12,
+};
+
+enum {
+    RI_GLOBAL_USAGE_PAGE    = 0,
+    RI_GLOBAL_LOGICAL_MIN   = 1,
+    RI_GLOBAL_LOGICAL_MAX   = 2,
+    RI_GLOBAL_PHYSICAL_MIN  = 3,
+    RI_GLOBAL_PHYSICAL_MAX  = 4,
+    RI_GLOBAL_UNIT_EXPONENT = 5,
+    RI_GLOBAL_UNIT          = 6,
+    RI_GLOBAL_REPORT_SIZE   = 7,
+    RI_GLOBAL_REPORT_ID     = 8,
+    RI_GLOBAL_REPORT_COUNT  = 9,
+    RI_GLOBAL_PUSH          = 10,
+    RI_GLOBAL_POP           = 11,
+};
+
+enum {
+    RI_LOCAL_USAGE     = 0,
+    RI_LOCAL_USAGE_MIN = 1,
+    RI_LOCAL_USAGE_MAX = 2,
+};
+
+/*==============================================================================
+ *  Usage Tables
+ *==============================================================================*/
+
+enum {
+    HID_USAGE_PAGE_DESKTOP   = 0x01,
+    HID_USAGE_PAGE_KEYBOARD  = 0x07,
+    HID_USAGE_PAGE_BUTTON    = 0x09,
+    HID_USAGE_PAGE_CONSUMER  = 0x0C,
+    HID_USAGE_PAGE_DIGITIZER = 0x0D,
+    HID_USAGE_PAGE_VENDOR    = 0xFF00,
+};
+
+enum {
+    HID_USAGE_DESKTOP_POINTER        = 0x01,
+    HID_USAGE_DESKTOP_MOUSE          = 0x02,
+    HID_USAGE_DESKTOP_KEYBOARD       = 0x06,
+    HID_USAGE_DESKTOP_X              = 0x30,
+    HID_USAGE_DESKTOP_Y              = 0x31,
+    HID_USAGE_DESKTOP_WHEEL          = 0x38,
+    HID_USAGE_DESKTOP_SYSTEM_CONTROL = 0x80,
+};
+
+enum {
+    HID_USAGE_CONSUMER_CONTROL = 0x0001,
+    HID_USAGE_CONSUMER_AC_PAN  = 0x0238,
+};
+
+enum {
+    KEYBOARD_MODIFIER_LEFTCTRL   = TU_BIT(0),
+    KEYBOARD_MODIFIER_LEFTSHIFT  = TU_BIT(1),
+    KEYBOARD_MODIFIER_LEFTALT    = TU_BIT(2),
+    KEYBOARD_MODIFIER_LEFTGUI    = TU_BIT(3),
+    KEYBOARD_MODIFIER_RIGHTCTRL  = TU_BIT(4),
+    KEYBOARD_MODIFIER_RIGHTSHIFT = TU_BIT(5),
+    KEYBOARD_MODIFIER_RIGHTALT   = TU_BIT(6),
+    KEYBOARD_MODIFIER_RIGHTGUI   = TU_BIT(7),
+};
+
+enum {
+    KEYBOARD_LED_NUMLOCK    = TU_BIT(0),
+    KEYBOARD_LED_CAPSLOCK   = TU_BIT(1),
+    KEYBOARD_LED_SCROLLLOCK = TU_BIT(2),
+};
+
+#define HID_KEY_NONE      0x00
+#define HID_KEY_A         0x04
+#define HID_KEY_B         0x05
+#define HID_KEY_C         0x06
+#define HID_KEY_D         0x07
+#define HID_KEY_E         0x08
+#define HID_KEY_F         0x09
+#define HID_KEY_G         0x0A
+#define HID_KEY_H         0x0B
+#define HID_KEY_I         0x0C
+#define HID_KEY_J         0x0D
+#define HID_KEY_K         0x0E
+#define HID_KEY_L         0x0F
+#define HID_KEY_M         0x10
+#define HID_KEY_N         0x11
+#define HID_KEY_O         0x12
+#define HID_KEY_P         0x13
+#define HID_KEY_Q         0x14
+#define HID_KEY_R         0x15
+#define HID_KEY_S         0x16
+#define HID_KEY_T         0x17
+#define HID_KEY_U         0x18
+#define HID_KEY_V         0x19
+#define HID_KEY_W         0x1A
+#define HID_KEY_X         0x1B
+#define HID_KEY_Y         0x1C
+#define HID_KEY_Z         0x1D
+#define HID_KEY_SEMICOLON 0x33
+#define HID_KEY_COMMA     0x36
+#define HID_KEY_PERIOD    0x37
+#define HID_KEY_SLASH     0x38
+#define HID_KEY_CAPS_LOCK 0x39
+#define HID_KEY_F12       0x45
+#define HID_KEY_F24       0x73
+
+/*==============================================================================
+ *  Device Stack
+ *==============================================================================*/
+
+void tud_task(void);
+bool tud_task_event_ready(void);
+bool tud_ready(void);
+bool tud_connected(void);
+bool tud_suspended(void);
+bool tud_remote_wakeup(void);
+bool tud_hid_n_ready(uint8_t instance);
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, void const *report, uint16_t len);
+bool tud_hid_keyboard_report(uint8_t report_id, uint8_t modifier, uint8_t const keycode[6]);
+
+/*==============================================================================
+ *  Host Stack
+ *==============================================================================*/
+
+void tuh_task(void);
+bool tuh_inited(void);
+bool tuh_task_event_ready(void);
+
+uint8_t tuh_hid_interface_protocol(uint8_t dev_addr, uint8_t idx);
+uint8_t tuh_hid_get_protocol(uint8_t dev_addr, uint8_t idx);
+bool tuh_hid_set_protocol(uint8_t dev_addr, uint8_t idx, uint8_t protocol);
+bool tuh_hid_receive_report(uint8_t dev_addr, uint8_t idx);
+
+void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t idx, uint8_t const *report_desc, uint16_t desc_len);
+void tuh_hid_umount_cb(uint8_t dev_addr, uint8_t idx);
+void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t idx, uint8_t const *report, uint16_t len);
+void tuh_hid_set_protocol_complete_cb(uint8_t dev_addr, uint8_t idx, uint8_t protocol);
@@ -0,0 +1,417 @@
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
+ */
+
+/* Replays a HID capture through the firmware, as if the devices were plugged into this board.
+ * Descriptors go through tuh_hid_mount_cb(), reports through tuh_hid_report_received_cb(),
+ * then the core0 tasks drain the queues into the (recorded) device stack and UART.
+ *
+ *   deskhop_replay [-r] [-b [-p version]] [-m] [-o outputs.cap] [-c expected.cap] input.cap
+ *   deskhop_replay -g [-s] [-f rate] input.cap
+ *
+ *   -r  replay at the recorded speed instead of as fast as possible
+ *   -b  the other board is the active output, so input goes over the UART at line speed
+ *   -o  save the produced reports and UART packets
+ *   -c  compare the produced outputs against a previously saved run
+ *   -m  check the pointer moved exactly as far as the mouse reports add up to, in zoom mode at
+ *       speed 30, where single counts come to fractions of a pixel
+ *   -g  write a synthetic capture of a mouse and keyboard to play with
+ *   -s  make the synthetic mouse creep along one count per report instead, with no typing
+ *   -f  mouse reports per second in the synthetic capture, 1000 by default
+ */
+
+#include <getopt.h>
+#include <time.h>
+#include "host.h"
+
+#define MAX_DIFFS_SHOWN 10
+
+typedef struct {
+    const char *name;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint32_t count;
+} stage_t;
+
+enum { STAGE_MOUNT, STAGE_INPUT, STAGE_OUTPUT, NUM_STAGES };
+
+/* Waits of the input lane's oldest packet for its transfer to start, see uart_lane_stats_t */
+static uint64_t link_wait_total_us;
+static uint32_t link_wait_count;
+
+/* Link version the other board keeps announcing in its heartbeat, 0 if it never does */
+static uint8_t peer_version;
+
+/* Speed used by -m, the zoom takes it down to 7.5 pixels per count */
+#define MOVEMENT_CHECK_SPEED 30
+
+static stage_t stages[NUM_STAGES] = {
+    [STAGE_MOUNT]  = {.name = "mount + parse", .min_ns = UINT64_MAX},
+    [STAGE_INPUT]  = {.name = "report in", .min_ns = UINT64_MAX},
+    [STAGE_OUTPUT] = {.name = "queues out", .min_ns = UINT64_MAX},
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void stage_add(stage_t *stage, uint64_t elapsed_ns) {
+    stage->total_ns += elapsed_ns;
+    stage->count++;
+
+    if (elapsed_ns < stage->min_ns)
+        stage->min_ns = elapsed_ns;
+
+    if (elapsed_ns > stage->max_ns)
+        stage->max_ns = elapsed_ns;
+}
+
+static bool outputs_pending(device_t *state) {
+    uint32_t level = ring_level(&state->kbd_queue.ring) + ring_level(&state->mouse_queue.ring);
+
+    for (int core = 0; core < NUM_CORES; core++) {
+        level += ring_level(&state->hid_queue_out[core].ring) + ring_level(&state->link_tx_queue[core].ring);
+
+        for (int lane = 0; lane < NUM_UART_LANES; lane++)
+            level += ring_level(&state->uart_tx_queue[core][lane].ring);
+    }
+
+    return level || state->mouse_pending_valid || state->uart_tx_staged || state->uart_tx_mouse_valid;
+}
+
+/* One pass of the core0 tasks that move queued reports out of the board */
+static void run_output_tasks(device_t *state) {
+    uart_lane_stats_t *link = &state->uart_tx_lane_stats[UART_LANE_INPUT];
+
+    host_set_core(0);
+
+    if (peer_version) {
+        state->peer_link_version = peer_version;
+        state->peer_heartbeat_us = time_us_64();
+    }
+
+    process_kbd_queue_task(state);
+    process_mouse_queue_task(state);
+    process_hid_queue_task(state);
+    flash_writer_task(state);
+
+    /* Only set when a transfer with input packets started */
+    link->latency_us = UINT32_MAX;
+    process_uart_tx_task(state);
+
+    if (link->latency_us != UINT32_MAX) {
+        link_wait_total_us += link->latency_us;
+        link_wait_count++;
+    }
+}
+
+static void replay(const capture_t *input, device_t *state, bool realtime) {
+    const capture_record_t *record;
+    size_t offset = 0;
+    uint64_t start_ns = now_ns();
+
+    while ((record = capture_next(input, &offset))) {
+        const uint8_t *payload = (const uint8_t *)(record + 1);
+
+        if (realtime) {
+            uint64_t due_ns = start_ns + (uint64_t)record->timestamp_us * 1000;
+            uint64_t current_ns = now_ns();
+
+            if (due_ns > current_ns)
+                sleep_us((due_ns - current_ns) / 1000);
+        }
+
+        /* Device side runs on core1 */
+        host_set_core(1);
+        uint64_t begin = now_ns();
+
+        switch (record->type) {
+            case CAPTURE_DESCRIPTOR:
+                host_set_interface(record->dev_addr, record->instance, record->itf_protocol, record->protocol);
+                tuh_hid_mount_cb(record->dev_addr, record->instance, payload, record->len);
+                stage_add(&stages[STAGE_MOUNT], now_ns() - begin);
+                break;
+
+            case CAPTURE_REPORT:
+                tuh_hid_report_received_cb(record->dev_addr, record->instance, payload, record->len);
+                stage_add(&stages[STAGE_INPUT], now_ns() - begin);
+                break;
+
+            default:
+                continue;
+        }
+
+        begin = now_ns();
+        run_output_tasks(state);
+        stage_add(&stages[STAGE_OUTPUT], now_ns() - begin);
+    }
+
+    /* Whatever is still queued gets flushed, the device stack is never busy here */
+    for (int pass = 0; pass < 4096 && outputs_pending(state); pass++)
+        run_output_tasks(state);
+
+    uint64_t elapsed_ns = now_ns() - start_ns;
+
+    printf("%u input records in %.3f ms, %.0f records/s\n",
+           input->count, elapsed_ns / 1e6, input->count / (elapsed_ns / 1e9));
+
+    for (int i = 0; i < NUM_STAGES; i++) {
+        stage_t *stage = &stages[i];
+
+        if (!stage->count)
+            continue;
+
+        printf("  %-14s %8u calls, ns min/avg/max %6lu / %8.1f / %8lu\n", stage->name, stage->count,
+               stage->min_ns, (double)stage->total_ns / stage->count, stage->max_ns);
+    }
+
+    if (link_wait_count)
+        printf("  %-14s %8u transfers, mouse packets %u merged, %u as deltas, input wait us avg/max %.1f / %u\n",
+               "uart link", link_wait_count, state->uart_tx_mouse_merged, state->uart_tx_mouse_packed,
+               (double)link_wait_total_us / link_wait_count,
+               state->uart_tx_lane_stats[UART_LANE_INPUT].latency_max_us);
+}
+
+static void print_record(const char *label, const capture_record_t *record) {
+    const uint8_t *payload = (const uint8_t *)(record + 1);
+
+    printf("    %s type %u id %u itf %u len %2u:", label, record->type, record->dev_addr, record->instance, record->len);
+
+    for (int i = 0; i < record->len && i < 16; i++)
+        printf(" %02x", payload[i]);
+
+    printf("\n");
+}
+
+static bool records_match(const capture_record_t *a, const capture_record_t *b) {
+    return a->type == b->type && a->dev_addr == b->dev_addr && a->instance == b->instance && a->len == b->len
+           && !memcmp(a + 1, b + 1, a->len);
+}
+
+/* Timestamps are ignored, only the order and the contents of outputs must match */
+static int compare_outputs(const capture_t *expected, const capture_t *actual) {
+    const capture_record_t *want, *got;
+    size_t want_offset = 0, got_offset = 0;
+    uint32_t index = 0, diffs = 0;
+
+    do {
+        want = capture_next(expected, &want_offset);
+        got  = capture_next(actual, &got_offset);
+
+        if (!want && !got)
+            break;
+
+        if (want && got && records_match(want, got)) {
+            index++;
+            continue;
+        }
+
+        if (diffs++ < MAX_DIFFS_SHOWN) {
+            printf("  output #%u differs\n", index);
+
+            if (want)
+                print_record("expected", want);
+
+            if (got)
+                print_record("actual  ", got);
+        }
+
+        index++;
+    } while (true);
+
+    printf("%u outputs expected, %u produced, %u differ\n", expected->count, actual->count, diffs);
+    return diffs ? 1 : 0;
+}
+
+/* Mouse going around in circles with a button click now and then, and some typing. Or if slow, a mouse
+   creeping down and to the right, one count per report and taking turns between the axes. */
+static void generate(capture_t *capture, uint32_t rate, bool slow) {
+    static const int8_t circle[16][2] = {
+        {8, 0}, {7, 3}, {6, 6}, {3, 7}, {0, 8}, {-3, 7}, {-6, 6}, {-7, 3},
+        {-8, 0}, {-7, -3}, {-6, -6}, {-3, -7}, {0, -8}, {3, -7}, {6, -6}, {7, -3},
+    };
+
+    capture_record_t mouse = {.type = CAPTURE_DESCRIPTOR, .dev_addr = 1, .itf_protocol = HID_ITF_PROTOCOL_MOUSE,
+                              .protocol = HID_PROTOCOL_REPORT, .len = host_mouse_descriptor_len};
+    capture_record_t keyboard = {.type = CAPTURE_DESCRIPTOR, .dev_addr = 2, .itf_protocol = HID_ITF_PROTOCOL_KEYBOARD,
+                                 .protocol = HID_PROTOCOL_REPORT, .len = host_keyboard_descriptor_len};
+
+    capture_append(capture, &mouse, host_mouse_descriptor);
+    capture_append(capture, &keyboard, host_keyboard_descriptor);
+
+    /* Creeping goes on for 2 s, so it stays on screen at the speed -m uses */
+    for (uint32_t n = 1; n <= rate * (slow ? 2 : 10); n++) {
+        uint8_t report[7] = {0};
+        uint32_t us = (uint64_t)n * 1000000 / rate, ms = us / 1000;
+        int16_t x = circle[(ms / 4) % 16][0], y = circle[(ms / 4) % 16][1];
+
+        if (slow) {
+            x = n & 1;
+            y = !x;
+        }
+
+        report[0] = ((ms % 500) < 50 && !slow) ? 1 : 0;
+        memcpy(&report[1], &x, sizeof(x));
+        memcpy(&report[3], &y, sizeof(y));
+
+        capture_record_t record = {.type = CAPTURE_REPORT, .timestamp_us = us, .dev_addr = 1, .len = sizeof(report)};
+        capture_append(capture, &record, report);
+
+        /* Keys keep to their own pace, whatever the mouse rate */
+        if (!slow && ms % 50 == 0 && ms != (uint64_t)(n - 1) * 1000 / rate) {
+            uint8_t keys[KBD_REPORT_LENGTH] = {0};
+
+            if (ms % 100 == 0)
+                keys[2] = HID_KEY_A + (ms / 100) % 26;
+
+            record = (capture_record_t){.type = CAPTURE_REPORT, .timestamp_us = us, .dev_addr = 2, .len = sizeof(keys)};
+            capture_append(capture, &record, keys);
+        }
+    }
+}
+
+/* Same scaling as update_mouse_position(), but summed over the whole capture before anything is rounded.
+   Carrying the residual between reports has to end up at exactly this, nothing lost along the way.
+   Only mouse reports laid out like the synthetic ones (buttons, then 16 bit X and Y) are counted. */
+static void add_up_movement(const capture_t *input, device_t *state, int64_t *sum_x, int64_t *sum_y) {
+    output_t *output = &state->config.output[state->active_output];
+    const capture_record_t *record;
+    size_t offset = 0;
+
+    while ((record = capture_next(input, &offset))) {
+        const uint8_t *payload = (const uint8_t *)(record + 1);
+        uint32_t factor = ACCEL_ONE;
+        int16_t x, y;
+
+        if (record->type != CAPTURE_REPORT || record->dev_addr != 1 || record->len < 5)
+            continue;
+
+        memcpy(&x, &payload[1], sizeof(x));
+        memcpy(&y, &payload[3], sizeof(y));
+
+        if (state->config.enable_acceleration) {
+            uint32_t index = (uint32_t)(x * x + y * y) >> ACCEL_LUT_SHIFT;
+            factor = state->accel_lut[state->active_output][index < ACCEL_LUT_SIZE ? index : ACCEL_LUT_SIZE - 1];
+        }
+
+        *sum_x += ((int64_t)x * output->speed_x * factor) >> MOUSE_ZOOM_SCALING_FACTOR;
+        *sum_y += ((int64_t)y * output->speed_y * factor) >> MOUSE_ZOOM_SCALING_FACTOR;
+    }
+}
+
+static int check_movement(const capture_t *input, device_t *state, int16_t start_x, int16_t start_y) {
+    int64_t sum_x = 0, sum_y = 0;
+
+    add_up_movement(input, state, &sum_x, &sum_y);
+
+    int32_t want_x = (sum_x + (ACCEL_ONE >> 1)) >> ACCEL_FRAC_BITS, got_x = state->pointer_x - start_x;
+    int32_t want_y = (sum_y + (ACCEL_ONE >> 1)) >> ACCEL_FRAC_BITS, got_y = state->pointer_y - start_y;
+    bool same = want_x == got_x && want_y == got_y;
+
+    printf("pointer moved %d, %d, reports add up to %d, %d, %s\n", got_x, got_y, want_x, want_y,
+           same ? "nothing lost" : "MOVEMENT LOST");
+
+    return same ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    const char *output_path = NULL, *compare_path = NULL;
+    bool realtime = false, generate_only = false, other_board = false, slow = false, check = false;
+    uint32_t rate = 1000;
+    capture_t input = {0}, output = {0}, expected = {0};
+    device_t *state = &global_state;
+    int opt, result = 0;
+
+    while ((opt = getopt(argc, argv, "rbp:mo:c:gsf:")) != -1) {
+        switch (opt) {
+            case 'r': realtime = true; break;
+            case 'b': other_board = true; break;
+            case 'p': peer_version = strtoul(optarg, NULL, 0); break;
+            case 'm': check = true; break;
+            case 'o': output_path = optarg; break;
+            case 'c': compare_path = optarg; break;
+            case 'g': generate_only = true; break;
+            case 's': slow = true; break;
+            case 'f': rate = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "Usage: %s [-r] [-b] [-m] [-o outputs.cap] [-c expected.cap] input.cap\n"
+                                "       %s -g [-s] [-f rate] input.cap\n", argv[0], argv[0]);
+                return 2;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Missing capture file\n");
+        return 2;
+    }
+
+    if (generate_only) {
+        if (!rate) {
+            fprintf(stderr, "Invalid rate\n");
+            return 2;
+        }
+
+        generate(&input, rate, slow);
+        return capture_save(&input, argv[optind]) ? 0 : 1;
+    }
+
+    if (!capture_load(&input, argv[optind])) {
+        fprintf(stderr, "Can't read capture %s\n", argv[optind]);
+        return 1;
+    }
+
+    host_init(state);
+    host_usb.output   = &output;
+    host_usb.start_us = time_us_64();
+
+    if (other_board) {
+        state->active_output = OUTPUT_B;
+        host_usb.uart_baud   = SERIAL_BAUDRATE;
+    }
+
+    /* From the middle of the screen, so the pointer doesn't stop at an edge */
+    if (check) {
+        state->mouse_zoom = true;
+        state->config.output[state->active_output].speed_x = MOVEMENT_CHECK_SPEED;
+        state->config.output[state->active_output].speed_y = MOVEMENT_CHECK_SPEED;
+        state->pointer_x = MAX_SCREEN_COORD / 2;
+        state->pointer_y = MAX_SCREEN_COORD / 2;
+    }
+
+    int16_t start_x = state->pointer_x, start_y = state->pointer_y;
+
+    replay(&input, state, realtime);
+    printf("%u reports to the PC, %u bytes to the other board\n", host_usb.hid_reports, host_usb.uart_bytes);
+
+    if (output_path && !capture_save(&output, output_path)) {
+        fprintf(stderr, "Can't write %s\n", output_path);
+        result = 1;
+    }
+
+    if (compare_path) {
+        if (!capture_load(&expected, compare_path)) {
+            fprintf(stderr, "Can't read capture %s\n", compare_path);
+            return 1;
+        }
+
+        result |= compare_outputs(&expected, &output);
+    }
+
+    if (check)
+        result |= check_movement(&input, state, start_x, start_y);
+
+    capture_free(&input);
+    capture_free(&output);
+    capture_free(&expected);
+    return result;
+}
@@ -0,0 +1,395 @@
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
+ */
+
+/* Host build shim, stands in for the pico-sdk, TinyUSB and the parts of the
+ * firmware (main.c, setup.c, led.c) that only make sense on hardware. */
+
+#include <stdio.h>
+#include <time.h>
+#include "host.h"
+
+device_t global_state = {0};
+host_usb_t host_usb   = {0};
+
+uint8_t uart_rxbuf[DMA_RX_BUFFER_SIZE] __attribute__((aligned(DMA_RX_BUFFER_SIZE)));
+uint8_t uart_txbuf[2][DMA_TX_BUFFER_SIZE] __attribute__((aligned(4)));
+
+/* Flash is all zeros, so load_config() falls back to the default config. Starts a sector, so saving it erases. */
+const config_t ADDR_CONFIG[1] __attribute__((aligned(FLASH_SECTOR_SIZE)));
+const uint8_t ADDR_FW_METADATA[FLASH_SECTOR_SIZE];
+/* Running image can be filled in through host_fw_image, the firmware only reads it. Sector aligned
+   like on flash, write_flash_page() erases whenever it starts a new one. */
+uint8_t host_fw_image[STAGING_IMAGE_SIZE] __attribute__((aligned(FLASH_SECTOR_SIZE)));
+extern const uint8_t ADDR_FW_RUNNING[STAGING_IMAGE_SIZE] __attribute__((alias("host_fw_image")));
+const uint8_t ADDR_FW_STAGING[STAGING_IMAGE_SIZE];
+const uint8_t ADDR_DISK_IMAGE[FLASH_SECTOR_SIZE];
+
+firmware_metadata_t _firmware_metadata = {.version = 0x0001};
+
+uint8_t host_ppb[0x10000];
+
+static watchdog_hw_t watchdog_regs;
+static ioqspi_hw_t ioqspi_regs;
+static sio_hw_t sio_regs;
+static armv6m_scb_hw_t scb_regs;
+static dma_channel_hw_t dma_channels[12];
+
+watchdog_hw_t *watchdog_hw  = &watchdog_regs;
+ioqspi_hw_t *ioqspi_hw      = &ioqspi_regs;
+sio_hw_t *sio_hw            = &sio_regs;
+armv6m_scb_hw_t *scb_hw     = &scb_regs;
+
+/* What the host stack knows about each mounted interface */
+static struct {
+    uint8_t itf_protocol;
+    uint8_t protocol;
+} host_interfaces[MAX_DEVICES][MAX_INTERFACES];
+
+static uart_inst_t *uart_instances[2];
+
+uart_inst_t *uart0 = (uart_inst_t *)&uart_instances[0];
+uart_inst_t *uart1 = (uart_inst_t *)&uart_instances[1];
+
+/* Each thread plays one of the cores */
+static __thread uint core_num;
+
+void host_set_core(uint core) {
+    core_num = core;
+}
+
+/* Bring up only what the input pipeline needs, a subset of initial_setup() */
+void host_init(device_t *state) {
+    memset(state, 0, sizeof(device_t));
+
+    load_config(state);
+
+    ring_init(&state->kbd_queue);
+    ring_init(&state->mouse_queue);
+
+    for (int core = 0; core < NUM_CORES; core++) {
+        ring_init(&state->hid_queue_out[core]);
+
+        for (int lane = 0; lane < NUM_UART_LANES; lane++)
+            ring_init(&state->uart_tx_queue[core][lane]);
+
+        ring_init(&state->link_tx_queue[core]);
+        ring_init(&state->flash_queue[core]);
+    }
+
+    /* RX DMA write pointer sits at the start of the ring, nothing received yet */
+    dma_channel_hw_addr(state->dma_rx_channel)->transfer_count = DMA_RX_BUFFER_SIZE;
+    state->uart_rx_needed = RAW_PACKET_LENGTH;
+
+    state->board_role    = OUTPUT_A;
+    state->active_output = OUTPUT_A;
+    state->tud_connected = true;
+}
+
+void host_set_interface(uint8_t dev_addr, uint8_t instance, uint8_t itf_protocol, uint8_t protocol) {
+    if (dev_addr == 0 || dev_addr >= MAX_DEVICES || instance >= MAX_INTERFACES)
+        return;
+
+    host_interfaces[dev_addr - 1][instance].itf_protocol = itf_protocol;
+    host_interfaces[dev_addr - 1][instance].protocol     = protocol;
+}
+
+/* Bytes arriving from the other board, written the way the RX DMA would: into the ring at the
+   write pointer, counting transfer_count down and wrapping around. */
+void host_uart_receive(device_t *state, const void *data, uint32_t len) {
+    dma_channel_hw_t *channel = dma_channel_hw_addr(state->dma_rx_channel);
+    const uint8_t *src = data;
+
+    for (uint32_t i = 0; i < len; i++) {
+        uart_rxbuf[DMA_RX_BUFFER_SIZE - channel->transfer_count] = src[i];
+
+        if (--channel->transfer_count == 0)
+            channel->transfer_count = DMA_RX_BUFFER_SIZE;
+    }
+}
+
+static void record_output(uint8_t type, uint8_t id, uint8_t instance, const void *data, uint16_t len) {
+    if (!host_usb.output)
+        return;
+
+    capture_record_t record = {
+        .timestamp_us = time_us_64() - host_usb.start_us,
+        .len          = len,
+        .type         = type,
+        .dev_addr     = id,
+        .instance     = instance,
+    };
+
+    capture_append(host_usb.output, &record, data);
+}
+
+/*==============================================================================
+ *  pico-sdk
+ *==============================================================================*/
+
+uint get_core_num(void) {
+    return core_num;
+}
+
+uint64_t time_us_64(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t time_us_32(void) {
+    return (uint32_t)time_us_64();
+}
+
+void sleep_us(uint64_t us) {
+    struct timespec ts = {.tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000};
+    nanosleep(&ts, NULL);
+}
+
+void sleep_ms(uint32_t ms) {
+    sleep_us((uint64_t)ms * 1000);
+}
+
+absolute_time_t from_us_since_boot(uint64_t us) {
+    return us;
+}
+
+/* Nothing else can wake us, so this is just a sleep until the deadline */
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp) {
+    uint64_t now = time_us_64();
+
+    if (timeout_timestamp > now)
+        sleep_us(timeout_timestamp - now);
+
+    host_usb.slept_us += time_us_64() - now;
+    return true;
+}
+
+void reset_usb_boot(uint32_t usb_activity_gpio_pin_mask, uint32_t disable_interface_mask) {
+    fprintf(stderr, "reset_usb_boot() called, exiting\n");
+    exit(1);
+}
+
+void watchdog_update(void) {
+}
+
+dma_channel_hw_t *dma_channel_hw_addr(uint channel) {
+    return &dma_channels[channel];
+}
+
+/* Only the UART TX channel is ever asked */
+bool dma_channel_is_busy(uint channel) {
+    return time_us_64() < host_usb.uart_busy_until;
+}
+
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void *read_addr, uint32_t transfer_count) {
+    /* Start bit, 8 data bits and a stop bit per byte */
+    if (host_usb.uart_baud)
+        host_usb.uart_busy_until = time_us_64() + ((uint64_t)transfer_count * 10 * 1000000 + host_usb.uart_baud - 1) / host_usb.uart_baud;
+
+    host_usb.uart_bytes += transfer_count;
+    record_output(CAPTURE_UART_OUT, 0, 0, (const void *)read_addr, transfer_count);
+}
+
+void gpio_set_function(uint gpio, enum gpio_function fn) {
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t event_mask, bool enabled) {
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask, bool enabled, gpio_irq_callback_t callback) {
+}
+
+void gpio_acknowledge_irq(uint gpio, uint32_t event_mask) {
+}
+
+uint uart_init(uart_inst_t *uart, uint baudrate) {
+    return baudrate;
+}
+
+void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts) {
+}
+
+void uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits, uart_parity_t parity) {
+}
+
+void uart_set_translate_crlf(uart_inst_t *uart, bool translate) {
+}
+
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled) {
+}
+
+/* Only the running image is backed by memory and only when asked for, writes anywhere else go nowhere.
+   Flash commands carry 24 bit addresses, so offsets wrap at 16 MB like on the chip. */
+static uint8_t *host_flash(uint32_t flash_offs, size_t count) {
+    uint32_t offset = (flash_offs + XIP_BASE - (uint32_t)(uintptr_t)host_fw_image) & 0xffffff;
+
+    if (!host_usb.flash_writable || offset >= STAGING_IMAGE_SIZE || count > STAGING_IMAGE_SIZE - offset)
+        return NULL;
+
+    return &host_fw_image[offset];
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    uint8_t *flash = host_flash(flash_offs, count);
+
+    if (flash)
+        memset(flash, 0xff, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+    uint8_t *flash = host_flash(flash_offs, count);
+
+    for (size_t i = 0; flash && i < count; i++)
+        flash[i] &= data[i];
+}
+
+/* The chip as the background writer sees it. Erase and program happen right away, but it reports
+   busy and ignores commands for as long as the real one would take. */
+void flash_do_cmd(const uint8_t *txbuf, uint8_t *rxbuf, size_t count) {
+    static bool write_enabled;
+    bool busy = time_us_64() < host_usb.flash_busy_until;
+    uint32_t offset = count >= 4 ? txbuf[1] << 16 | txbuf[2] << 8 | txbuf[3] : 0;
+
+    memset(rxbuf, 0, count);
+
+    if (txbuf[0] == FLASH_CMD_READ_STATUS && count >= 2)
+        rxbuf[1] = (busy ? FLASH_STATUS_BUSY : 0) | (write_enabled ? 0x02 : 0);
+
+    if (busy)
+        return;
+
+    if (txbuf[0] == FLASH_CMD_WRITE_ENABLE)
+        write_enabled = true;
+
+    if (!write_enabled || count < 4)
+        return;
+
+    if (txbuf[0] == FLASH_CMD_SECTOR_ERASE) {
+        flash_range_erase(offset, FLASH_SECTOR_SIZE);
+        host_usb.flash_busy_until = time_us_64() + host_usb.flash_erase_us;
+        write_enabled = false;
+    }
+
+    if (txbuf[0] == FLASH_CMD_PAGE_PROGRAM) {
+        flash_range_program(offset, &txbuf[4], count - 4);
+        host_usb.flash_busy_until = time_us_64() + host_usb.flash_program_us;
+        write_enabled = false;
+    }
+}
+
+/*==============================================================================
+ *  TinyUSB
+ *==============================================================================*/
+
+void tud_task(void) {
+}
+
+bool tud_task_event_ready(void) {
+    return false;
+}
+
+bool tud_ready(void) {
+    return true;
+}
+
+bool tud_connected(void) {
+    return true;
+}
+
+bool tud_suspended(void) {
+    return false;
+}
+
+bool tud_remote_wakeup(void) {
+    return true;
+}
+
+bool tud_hid_n_ready(uint8_t instance) {
+    return !host_usb.hid_busy;
+}
+
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, void const *report, uint16_t len) {
+    if (host_usb.hid_busy)
+        return false;
+
+    host_usb.hid_reports++;
+    record_output(CAPTURE_HID_OUT, report_id, instance, report, len);
+    return true;
+}
+
+bool tud_hid_keyboard_report(uint8_t report_id, uint8_t modifier, uint8_t const keycode[6]) {
+    return tud_hid_n_report(ITF_NUM_HID, report_id, keycode, KBD_REPORT_LENGTH);
+}
+
+/* Same as in usb_descriptors.c, which needs the real TinyUSB descriptor macros */
+bool tud_mouse_report(uint8_t mode, uint8_t buttons, int16_t x, int16_t y, int8_t wheel, int8_t pan) {
+    mouse_report_t report = {.buttons = buttons, .wheel = wheel, .x = x, .y = y, .mode = mode, .pan = pan};
+    uint8_t instance = ITF_NUM_HID;
+    uint8_t report_id = REPORT_ID_MOUSE;
+
+    if (mode == RELATIVE) {
+        instance = ITF_NUM_HID_REL_M;
+        report_id = REPORT_ID_RELMOUSE;
+    }
+
+    return tud_hid_n_report(instance, report_id, &report, sizeof(report));
+}
+
+void tuh_task(void) {
+}
+
+bool tuh_inited(void) {
+    return true;
+}
+
+bool tuh_task_event_ready(void) {
+    return false;
+}
+
+/* Host stack, the capture provides what the device would have told us on enumeration */
+uint8_t tuh_hid_interface_protocol(uint8_t dev_addr, uint8_t idx) {
+    if (dev_addr == 0 || dev_addr >= MAX_DEVICES || idx >= MAX_INTERFACES)
+        return HID_ITF_PROTOCOL_NONE;
+
+    return host_interfaces[dev_addr - 1][idx].itf_protocol;
+}
+
+uint8_t tuh_hid_get_protocol(uint8_t dev_addr, uint8_t idx) {
+    if (dev_addr == 0 || dev_addr >= MAX_DEVICES || idx >= MAX_INTERFACES)
+        return HID_PROTOCOL_REPORT;
+
+    return host_interfaces[dev_addr - 1][idx].protocol;
+}
+
+/* The real stack completes this asynchronously, here the device always agrees right away */
+bool tuh_hid_set_protocol(uint8_t dev_addr, uint8_t idx, uint8_t protocol) {
+    host_set_interface(dev_addr, idx, tuh_hid_interface_protocol(dev_addr, idx), protocol);
+    tuh_hid_set_protocol_complete_cb(dev_addr, idx, protocol);
+    return true;
+}
+
+bool tuh_hid_receive_report(uint8_t dev_addr, uint8_t idx) {
+    return true;
+}
+
+/*==============================================================================
+ *  Firmware parts that only run on hardware
+ *==============================================================================*/
+
+void blink_led(device_t *state) {
+}
+
+void restore_leds(device_t *state) {
+}
+
+uint8_t toggle_led(void) {
+    return 0;
+}
@@ -10,6 +10,18 @@
  */
 #include "main.h"
 
+/* Default mouse acceleration curve, movement magnitude -> factor */
+#define DEFAULT_ACCEL_CURVE {                                                       \
+                             /* 4 |                                        *    */ \
+        {2, ACCEL_Q(1.0)},   /*   |                                  *          */ \
+        {5, ACCEL_Q(1.1)},   /* 3 |                                             */ \
+        {15, ACCEL_Q(1.4)},  /*   |                       *                     */ \
+        {30, ACCEL_Q(1.9)},  /* 2 |                *                            */ \
+        {45, ACCEL_Q(2.6)},  /*   |        *                                    */ \
+        {60, ACCEL_Q(3.4)},  /* 1 |  *                                          */ \
+        {70, ACCEL_Q(4.0)},  /*    -------------------------------------------  */ \
+    }                        /*        10    20    30    40    50    60    70   */
+
 /* Default configuration */
 const config_t default_config = {
     .magic_header = 0xB00B1E5,
@@ -32,7 +44,8 @@ const config_t default_config = {
                 .only_if_inactive = SCREENSAVER_A_ONLY_IF_INACTIVE,
                 .idle_time_us = (uint64_t)SCREENSAVER_A_IDLE_TIME_SEC * 1000000,
                 .max_time_us = (uint64_t)SCREENSAVER_A_MAX_TIME_SEC * 1000000,
-            }
+            },
+            .accel_curve = DEFAULT_ACCEL_CURVE,
         },
     .output[OUTPUT_B] =
         {
@@ -52,7 +65,8 @@ const config_t default_config = {
                 .only_if_inactive = SCREENSAVER_B_ONLY_IF_INACTIVE,
                 .idle_time_us = (uint64_t)SCREENSAVER_B_IDLE_TIME_SEC * 1000000,
                 .max_time_us = (uint64_t)SCREENSAVER_B_MAX_TIME_SEC * 1000000,
-            }
+            },
+            .accel_curve = DEFAULT_ACCEL_CURVE,
         },
     .enforce_ports = ENFORCE_PORTS,
     .force_kbd_boot_protocol = ENFORCE_KEYBOARD_BOOT_PROTOCOL,
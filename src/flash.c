@@ -0,0 +1,177 @@
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
+ */
+
+#include "main.h"
+
+/* ================================================== *
+ * Background flash writer
+ *
+ * flash_range_erase() keeps a core in the ROM with interrupts off for the whole sector erase,
+ * tens of ms. Instead, FLASH_WRITER_CORE only sends the command, the chip erases on its own and
+ * the task checks back until it's done. The whole image runs from RAM (PICO_COPY_TO_RAM), so both
+ * cores keep going meanwhile. The one thing they can't do is read flash, that goes through
+ * try_lock_flash() / lock_flash(), and no job starts while the other core holds it.
+ * ================================================== */
+
+/* flash_do_cmd() takes the chip out of XIP mode and restores it after the command */
+static void flash_command(const uint8_t *command, uint8_t *response, size_t length) {
+    uint32_t ints = save_and_disable_interrupts();
+    flash_do_cmd(command, response, length);
+    restore_interrupts(ints);
+}
+
+/* XIP is set up again right after reading the status, so once the chip says it's idle, that went
+   through too and flash reads work again */
+static bool flash_chip_busy(void) {
+    uint8_t command[2] = {FLASH_CMD_READ_STATUS}, response[2];
+
+    flash_command(command, response, sizeof(command));
+    return response[1] & FLASH_STATUS_BUSY;
+}
+
+static void start_flash_job(flash_job_t *job) {
+    static uint8_t response[sizeof(flash_job_t)];
+    uint8_t write_enable = FLASH_CMD_WRITE_ENABLE;
+    size_t length = sizeof(job->command);
+
+    if (job->command[0] == FLASH_CMD_PAGE_PROGRAM)
+        length += FLASH_PAGE_SIZE;
+
+    flash_command(&write_enable, response, 1);
+    flash_command((const uint8_t *)job, response, length);
+}
+
+static bool other_core_reading(flash_writer_t *flash) {
+    for (int core = 0; core < NUM_CORES; core++)
+        if (core != FLASH_WRITER_CORE && flash->reading[core])
+            return true;
+
+    return false;
+}
+
+/* A job on our image makes the CRC we have of that sector stale. The other core only updates the
+   CRCs while it's reading flash, and it isn't now, so the two can't collide. */
+static void forget_sector_crc(device_t *state, const flash_job_t *job) {
+    uint32_t offset = job->command[1] << 16 | job->command[2] << 8 | job->command[3];
+    uint32_t sector = ((offset - ((uint32_t)ADDR_FW_RUNNING - XIP_BASE)) & 0xffffff) / FLASH_SECTOR_SIZE;
+
+    if (sector < FW_SECTORS)
+        state->sector_crcs.valid &= ~(1ull << sector);
+}
+
+/* Finishes the job in flight and starts the next one, taking turns between the cores' queues */
+void flash_writer_task(device_t *state) {
+    flash_writer_t *flash = &state->flash;
+
+    if (flash->busy) {
+        if (flash_chip_busy())
+            return;
+
+        ring_pop(&state->flash_queue[flash->core].ring);
+        flash->jobs++;
+        __dmb();
+        flash->busy = false;
+        __sev(); /* The other core might be sleeping until it can read flash again */
+    }
+
+    for (int i = 1; i <= NUM_CORES; i++) {
+        uint8_t core = (flash->core + i) % NUM_CORES;
+        flash_job_t *job = ring_peek(&state->flash_queue[core].ring);
+
+        if (!job)
+            continue;
+
+        /* Announce the job before looking, so a reader either sees it or we see the reader */
+        flash->busy = true;
+        __dmb();
+
+        if (other_core_reading(flash)) {
+            flash->busy = false;
+            return;
+        }
+
+        flash->core = core;
+        forget_sector_crc(state, job);
+        start_flash_job(job);
+        return;
+    }
+}
+
+bool flash_writer_idle(device_t *state) {
+    if (state->flash.busy)
+        return false;
+
+    for (int core = 0; core < NUM_CORES; core++)
+        if (ring_level(&state->flash_queue[core].ring))
+            return false;
+
+    return true;
+}
+
+/* On the writer's own core nobody else would move the queue along, so waiting means doing the work */
+static void flash_writer_wait(device_t *state) {
+    if (get_core_num() == FLASH_WRITER_CORE)
+        flash_writer_task(state);
+}
+
+/* Blocks until everything queued so far, from either core, is in flash */
+void wait_for_flash(device_t *state) {
+    while (!flash_writer_idle(state))
+        flash_writer_wait(state);
+}
+
+uint32_t flash_queue_room(device_t *state) {
+    ring_t *queue = &state->flash_queue[get_core_num()].ring;
+    return queue->mask + 1 - ring_level(queue);
+}
+
+/* Jobs are copied in, the caller's buffer is free once this returns. Waits only if the queue is full. */
+static void queue_flash_job(device_t *state, uint8_t opcode, uint32_t offset, const uint8_t *data) {
+    flash_job_t job = {.command = {opcode, offset >> 16, offset >> 8, offset}};
+
+    if (data)
+        memcpy(job.data, data, FLASH_PAGE_SIZE);
+
+    while (!ring_try_add(&state->flash_queue[get_core_num()].ring, &job))
+        flash_writer_wait(state);
+}
+
+void queue_flash_erase(device_t *state, uint32_t offset) {
+    queue_flash_job(state, FLASH_CMD_SECTOR_ERASE, offset, NULL);
+}
+
+void queue_flash_page(device_t *state, uint32_t offset, const uint8_t *data) {
+    queue_flash_job(state, FLASH_CMD_PAGE_PROGRAM, offset, data);
+}
+
+/* Flash can be read until unlock_flash(), false if a job is in progress */
+bool try_lock_flash(device_t *state) {
+    volatile bool *reading = &state->flash.reading[get_core_num()];
+
+    *reading = true;
+    __dmb();
+
+    if (!state->flash.busy)
+        return true;
+
+    *reading = false;
+    return false;
+}
+
+void lock_flash(device_t *state) {
+    while (!try_lock_flash(state))
+        flash_writer_wait(state);
+}
+
+void unlock_flash(device_t *state) {
+    __dmb();
+    state->flash.reading[get_core_num()] = false;
+}
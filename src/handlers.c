@@ -53,6 +53,7 @@ void screen_border_hotkey_handler(device_t *state, hid_keyboard_report_t *report
 
 /* This key combo puts board A in firmware upgrade mode */
 void fw_upgrade_hotkey_handler_A(device_t *state, hid_keyboard_report_t *report) {
+    wait_for_flash(state);
     reset_usb_boot(1 << PICO_DEFAULT_LED_PIN, 0);
 };
 
@@ -164,14 +165,51 @@ void handle_keyboard_uart_msg(uart_packet_t *packet, device_t *state) {
     state->last_activity[BOARD_ROLE] = time_us_64();
 }
 
-/* Function handles received mouse moves from the other board */
-void handle_mouse_abs_uart_msg(uart_packet_t *packet, device_t *state) {
-    mouse_report_t *mouse_report = (mouse_report_t *)packet->data;
+static void receive_mouse_report(mouse_report_t *mouse_report, device_t *state) {
     queue_mouse_report(mouse_report, state);
 
     state->pointer_x       = mouse_report->x;
     state->pointer_y       = mouse_report->y;
     state->mouse_buttons   = mouse_report->buttons;
+}
+
+/* Function handles received mouse moves from the other board */
+void handle_mouse_abs_uart_msg(uart_packet_t *packet, device_t *state) {
+    receive_mouse_report((mouse_report_t *)packet->data, state);
+    state->last_activity[BOARD_ROLE] = time_us_64();
+}
+
+/* Several mouse moves in one long frame, rebuilt into the reports they were made from */
+void handle_mouse_trail_msg(link_packet_t *packet, device_t *state) {
+    mouse_trail_t trail;
+    uint32_t length = state->uart_rx_payload_len;
+
+    if (length <= MOUSE_REPORT_LENGTH || length > sizeof(trail))
+        return;
+
+    memcpy(&trail, packet->data, length);
+
+    /* Count has to agree with the frame length, or we'd make up positions */
+    if (trail.count > (length - MOUSE_REPORT_LENGTH - 1) / 2)
+        return;
+
+    receive_mouse_report(&trail.report, state);
+
+    /* Wheel and pan went with the first one */
+    trail.report.wheel = 0;
+    trail.report.pan   = 0;
+
+    for (int i = 0; i < trail.count; i++) {
+        if (trail.report.mode == RELATIVE) {
+            trail.report.x = trail.delta[i][0];
+            trail.report.y = trail.delta[i][1];
+        } else {
+            trail.report.x += trail.delta[i][0];
+            trail.report.y += trail.delta[i][1];
+        }
+
+        receive_mouse_report(&trail.report, state);
+    }
 
     state->last_activity[BOARD_ROLE] = time_us_64();
 }
@@ -187,6 +225,7 @@ void handle_output_select_msg(uart_packet_t *packet, device_t *state) {
 
 /* On firmware upgrade message, reboot into the BOOTSEL fw upgrade mode */
 void handle_fw_upgrade_msg(uart_packet_t *packet, device_t *state) {
+    wait_for_flash(state);
     reset_usb_boot(1 << PICO_DEFAULT_LED_PIN, 0);
 }
 
@@ -282,6 +321,14 @@ void handle_api_msgs(uart_packet_t *packet, device_t *state) {
             return;
 
         memcpy(ptr, &packet->data[1], map->len);
+
+        /* Curve points are compiled into a lookup table, so it needs to be rebuilt when they change */
+        for (int out = 0; out < NUM_SCREENS; out++) {
+            accel_point_t *curve = state->config.output[out].accel_curve;
+
+            if (ptr >= (uint8_t *)curve && ptr < (uint8_t *)(curve + ACCEL_POINTS))
+                build_acceleration_table(state);
+        }
     }
     else if (packet->type == GET_VAL_MSG) {
         uart_packet_t response = {.type=GET_VAL_MSG, .data={[0] = value_idx}};
@@ -293,30 +340,148 @@ void handle_api_msgs(uart_packet_t *packet, device_t *state) {
     reset_config_timer(state);
 }
 
-/* Handle the "read all" message by calling our "read one" handler for each type */
+/* Handle the "read all" message by calling our "read one" handler for each type. Statistics are
+   left out, the page polls them with GET_VAL and all of them wouldn't fit in hid_queue_out. */
 void handle_api_read_all_msg(uart_packet_t *packet, device_t *state) {
     uart_packet_t result = {.type=GET_VAL_MSG};
 
     for (int i = 0; i < get_field_map_length(); i++) {
+        if (get_field_map_index(i)->polled)
+            continue;
+
         result.data[0] = get_field_map_index(i)->idx;
         handle_api_msgs(&result, state);
     }
 }
 
 /* Process request packet and create a response */
-void handle_request_byte_msg(uart_packet_t *packet, device_t *state) {
+/* Queues FW_CHUNK_SIZE bytes of our firmware starting at address, false if they can't go in a long frame */
+static bool queue_firmware_chunk(uint32_t address) {
+    uint8_t chunk[sizeof(uint32_t) + FW_CHUNK_SIZE];
+
+    memcpy(chunk, &address, sizeof(uint32_t));
+    memcpy(&chunk[sizeof(uint32_t)], &ADDR_FW_RUNNING[address], FW_CHUNK_SIZE);
+
+    return queue_link_packet(chunk, RESPONSE_CHUNK_MSG, sizeof(chunk));
+}
+
+/* Reads our image, so the caller holds the flash lock */
+static void answer_byte_request(uart_packet_t *packet) {
     uint32_t address = packet->data32[0];
 
-    if (address > STAGING_IMAGE_SIZE)
+    /* If the other board takes long frames, answer with a whole chunk. It knows by the packet type. */
+    if (!(address % FW_CHUNK_SIZE) && queue_firmware_chunk(address))
         return;
 
     /* Add requested data to bytes 4-7 in the packet and return it with a different type */
-    uint32_t data = *(uint32_t *)&ADDR_FW_RUNNING[address];
-    packet->data32[1] = data;
+    packet->data32[1] = *(uint32_t *)&ADDR_FW_RUNNING[address];
 
     queue_packet(packet->data, RESPONSE_BYTE_MSG, PACKET_DATA_LENGTH);
 }
 
+void handle_request_byte_msg(uart_packet_t *packet, device_t *state) {
+    if (packet->data32[0] > STAGING_IMAGE_SIZE)
+        return;
+
+    /* Asking again isn't something this board would do. While our flash is being written the request
+       is kept and answered from the packet receiver later, instead of waiting here for the erase. */
+    if (!try_lock_flash(state)) {
+        state->byte_request          = *packet;
+        state->byte_request_deferred = true;
+        return;
+    }
+
+    answer_byte_request(packet);
+    unlock_flash(state);
+}
+
+void answer_deferred_byte_request(device_t *state) {
+    if (!state->byte_request_deferred || !try_lock_flash(state))
+        return;
+
+    state->byte_request_deferred = false;
+    answer_byte_request(&state->byte_request);
+    unlock_flash(state);
+}
+
+/* The board asking doesn't send heartbeats while upgrading, so its requests carry the link version
+   instead, otherwise we'd stop sending long frames */
+static void note_firmware_request(uart_packet_t *packet, device_t *state) {
+    state->peer_link_version = packet->data[6];
+    state->peer_heartbeat_us = time_us_64();
+}
+
+/* Answer with every chunk of the page */
+void handle_request_page_msg(uart_packet_t *packet, device_t *state) {
+    uint32_t page = packet->data32[0];
+    ring_t *queue = &state->link_tx_queue[get_core_num()].ring;
+
+    _Static_assert(FW_WINDOW_PAGES * FW_CHUNKS_PER_PAGE <= LINK_QUEUE_LENGTH, "Whole window has to fit in the queue");
+
+    note_firmware_request(packet, state);
+
+    /* All of it or nothing, pages that don't show up are requested again. So are those asked for
+       while our flash is being written. */
+    if (page >= STAGING_PAGES_CNT || queue->mask + 1 - ring_level(queue) < FW_CHUNKS_PER_PAGE || !try_lock_flash(state))
+        return;
+
+    fw_lz_fragment_t fragment = {.page = page};
+
+    /* Compressed if the other board takes it and it comes out smaller, at most FW_CHUNKS_PER_PAGE pieces */
+    if (state->peer_link_version >= LINK_VERSION_FW_LZ) {
+        uint8_t compressed[FLASH_PAGE_SIZE];
+
+        fragment.length = compress_page(&ADDR_FW_RUNNING[page * FLASH_PAGE_SIZE], compressed);
+
+        for (uint32_t offset = 0; offset < fragment.length; offset += FW_LZ_FRAGMENT_SIZE) {
+            uint32_t length = fragment.length - offset;
+
+            if (length > FW_LZ_FRAGMENT_SIZE)
+                length = FW_LZ_FRAGMENT_SIZE;
+
+            fragment.offset = offset;
+            memcpy(fragment.data, &compressed[offset], length);
+
+            /* Header makes it at least 5 bytes, short ones are padded up to the usual 8 */
+            queue_link_packet((uint8_t *)&fragment, RESPONSE_PAGE_LZ_MSG, 4 + (length < 4 ? 4 : length));
+        }
+    }
+
+    if (!fragment.length)
+        for (uint32_t offset = 0; offset < FLASH_PAGE_SIZE; offset += FW_CHUNK_SIZE)
+            queue_firmware_chunk(page * FLASH_PAGE_SIZE + offset);
+
+    unlock_flash(state);
+}
+
+/* Answer with the CRC32 of each sector of our image. Reading all of it would stop the receiver for
+   too long, firmware_upgrade_task() sends the parts as it works the CRCs out. A repeated request
+   gets all of them again. */
+void handle_request_manifest_msg(uart_packet_t *packet, device_t *state) {
+    note_firmware_request(packet, state);
+    state->sector_crcs.unsent = FW_ALL_SECTORS;
+}
+
+/* The other board's sector CRCs, firmware_page_task() compares them with ours */
+void handle_fw_manifest_msg(link_packet_t *packet, device_t *state) {
+    fw_manifest_t *manifest = (fw_manifest_t *)packet->data;
+
+    _Static_assert(FW_SECTORS <= 64, "Sector bits have to fit in a uint64_t");
+
+    if (!state->fw.upgrade_in_progress || !state->fw.manifest_pending || manifest->count > FW_MANIFEST_ENTRIES
+        || manifest->first + manifest->count > FW_SECTORS || state->uart_rx_payload_len < 2 + manifest->count * sizeof(uint32_t))
+        return;
+
+    for (int i = 0; i < manifest->count; i++) {
+        uint32_t sector = manifest->first + i;
+
+        state->fw.peer_crc[sector] = manifest->crc[i];
+        state->fw.manifest_received |= 1ull << sector;
+    }
+
+    state->fw.byte_done = true;
+}
+
 /* Process response message following a request we sent to read a byte */
 /* state->page_offset and state->page_number are kept locally and compared to returned values */
 void handle_response_byte_msg(uart_packet_t *packet, device_t *state) {
@@ -346,10 +511,108 @@ void handle_response_byte_msg(uart_packet_t *packet, device_t *state) {
     state->fw.byte_done = true;
 }
 
+/* Window slot of a page we're waiting for, NULL if it's not one of those */
+static fw_page_slot_t *get_page_slot(device_t *state, uint32_t page) {
+    fw_page_slot_t *slot = &state->fw.window[page % FW_WINDOW_PAGES];
+
+    if (!state->fw.upgrade_in_progress || slot->page != page || page < state->fw.address / FLASH_PAGE_SIZE
+        || page >= state->fw.next_page)
+        return NULL;
+
+    return slot;
+}
+
+/* Chunks of the pages in the window can come in any order, and more than once after a retry */
+static void receive_page_chunk(device_t *state, uint32_t address, const uint8_t *data) {
+    fw_page_slot_t *slot = get_page_slot(state, address / FLASH_PAGE_SIZE);
+
+    _Static_assert(FW_CHUNKS_PER_PAGE <= 8, "Chunk bits have to fit in fw_page_slot_t");
+
+    if (!slot || address % FW_CHUNK_SIZE)
+        return;
+
+    /* The other board sent this page compressed before, start over with the chunks */
+    if (slot->length)
+        *slot = (fw_page_slot_t){.page = slot->page, .expected = FW_PAGE_COMPLETE, .requested_us = slot->requested_us};
+
+    memcpy(&slot->data[address % FLASH_PAGE_SIZE], data, FW_CHUNK_SIZE);
+    slot->chunks |= 1 << (address % FLASH_PAGE_SIZE / FW_CHUNK_SIZE);
+
+    /* Page is complete, the upgrade task writes it and moves the window */
+    if (slot->chunks == slot->expected)
+        state->fw.byte_done = true;
+}
+
+/* Same for a piece of a compressed page, it stays compressed in the slot until it's written */
+void handle_response_page_lz_msg(link_packet_t *packet, device_t *state) {
+    fw_lz_fragment_t *fragment = (fw_lz_fragment_t *)packet->data;
+    fw_page_slot_t *slot = get_page_slot(state, fragment->page);
+    uint32_t pieces = (fragment->length + FW_LZ_FRAGMENT_SIZE - 1) / FW_LZ_FRAGMENT_SIZE;
+
+    if (!slot || !fragment->length || fragment->offset >= fragment->length || fragment->offset % FW_LZ_FRAGMENT_SIZE)
+        return;
+
+    uint32_t length = fragment->length - fragment->offset;
+
+    if (length > FW_LZ_FRAGMENT_SIZE)
+        length = FW_LZ_FRAGMENT_SIZE;
+
+    if (state->uart_rx_payload_len < 4 + length)
+        return;
+
+    if (slot->length != fragment->length) {
+        slot->length   = fragment->length;
+        slot->chunks   = 0;
+        slot->expected = (1 << pieces) - 1;
+    }
+
+    memcpy(&slot->data[fragment->offset], fragment->data, length);
+    slot->chunks |= 1 << (fragment->offset / FW_LZ_FRAGMENT_SIZE);
+
+    if (slot->chunks == slot->expected)
+        state->fw.byte_done = true;
+}
+
+/* Same as above, but for a whole chunk received in a long frame */
+void handle_response_chunk_msg(link_packet_t *packet, device_t *state) {
+    uint32_t address = packet->data32[0];
+    uint8_t *data = &packet->data[sizeof(uint32_t)];
+
+    if (state->uart_rx_payload_len < sizeof(uint32_t) + FW_CHUNK_SIZE)
+        return;
+
+    if (state->fw.paged) {
+        receive_page_chunk(state, address, data);
+        return;
+    }
+
+    if (address != state->fw.address) {
+        state->fw.upgrade_in_progress = false;
+        state->fw.address = 0;
+        return;
+    }
+
+    if ((address & 0xfff) == 0x000)
+        toggle_led();
+
+    if (address < STAGING_IMAGE_SIZE - FLASH_SECTOR_SIZE)
+        for (int i = 0; i < FW_CHUNK_SIZE; i++)
+            state->fw.checksum = crc32_iter(state->fw.checksum, data[i]);
+
+    memcpy(state->page_buffer + (address & (FLASH_PAGE_SIZE - 1)), data, FW_CHUNK_SIZE);
+
+    state->fw.address += FW_CHUNK_SIZE;
+    state->fw.byte_done = true;
+}
+
 /* Process a request to read a firmware package from flash */
 void handle_heartbeat_msg(uart_packet_t *packet, device_t *state) {
     uint16_t other_running_version = packet->data16[0];
 
+    /* Older boards leave this byte at 0, so we keep to the regular frames with them */
+    state->peer_link_version = packet->data[6];
+    state->peer_heartbeat_us = time_us_64();
+
     if (state->fw.upgrade_in_progress)
         return;
 
@@ -363,6 +626,10 @@ void handle_heartbeat_msg(uart_packet_t *packet, device_t *state) {
         .byte_done = true,
         .address = 0,
         .checksum = 0xffffffff,
+        .paged = state->peer_link_version >= LINK_VERSION_FW_PAGES,
+        .started_us = time_us_32(),
+        .manifest_pending = state->peer_link_version >= LINK_VERSION_FW_DELTA,
+        .manifest_requested_us = time_us_32() - FW_MANIFEST_TIMEOUT_US,
     };
 }
 
@@ -51,6 +51,21 @@
 #define MOUSE_BOOT_REPORT_LEN 4
 #define MOUSE_ZOOM_SCALING_FACTOR 2
 #define NUM_SCREENS 2
+#define MAX_TASKS_PER_CORE 8
+#define NUM_CORES 2
+#define UART_RX_BUDGET 16 // Most packets the receiver handles in one pass
+
+/*==============================================================================
+ *  Mouse Acceleration
+ *==============================================================================*/
+
+#define ACCEL_POINTS    7    // Number of points defining the acceleration curve
+#define ACCEL_FRAC_BITS 12   // Acceleration factors are Q12 fixed point
+#define ACCEL_ONE       (1 << ACCEL_FRAC_BITS)
+#define ACCEL_LUT_SHIFT 2    // Each table entry covers 4 consecutive squared magnitudes
+#define ACCEL_LUT_SIZE  2048 // Covers movement magnitudes up to ~90
+
+#define ACCEL_Q(x) ((uint16_t)((x) * ACCEL_ONE + 0.5))
 
 /*==============================================================================
  *  Utility Macros
@@ -16,15 +16,17 @@
  *  DMA Buffer Sizes
  *==============================================================================*/
 
-#define DMA_RX_BUFFER_SIZE 1024
-#define DMA_TX_BUFFER_SIZE 32
+#define DMA_RX_BUFFER_SIZE  1024
+#define UART_TX_BATCH       16 // Packets sent back-to-back in one DMA transfer
+#define DMA_TX_BUFFER_SIZE  (UART_TX_BATCH * LINK_FRAME_LENGTH(PACKET_DATA_LENGTH))
+#define UART_TX_BULK_BUDGET LINK_MAX_FRAME_LENGTH // Most bytes of bulk traffic per transfer, one long frame fits
 
 /*==============================================================================
  *  DMA Buffers
  *==============================================================================*/
 
 extern uint8_t uart_rxbuf[DMA_RX_BUFFER_SIZE] __attribute__((aligned(DMA_RX_BUFFER_SIZE)));
-extern uint8_t uart_txbuf[DMA_TX_BUFFER_SIZE] __attribute__((aligned(DMA_TX_BUFFER_SIZE)));
+extern uint8_t uart_txbuf[2][DMA_TX_BUFFER_SIZE] __attribute__((aligned(4)));
 
 /*==============================================================================
  *  Ring Buffer Macro
@@ -18,6 +18,9 @@
   *==============================================================================*/
 
  uint32_t calculate_firmware_crc32(void);
+ bool     update_sector_crcs(device_t *, uint64_t);
+ uint32_t compress_page(const uint8_t *, uint8_t *);
+ bool     decompress_page(const uint8_t *, uint32_t, uint8_t *);
  void     reboot(void);
  void     write_flash_page(uint32_t, uint8_t *);
 
@@ -25,10 +28,25 @@
   *  UART Packet Fetching
   *  Functions to handle incoming UART packets, especially for firmware updates.
   *==============================================================================*/
- void     fetch_packet(device_t *);
+ uart_packet_t *fetch_packet(device_t *, uint32_t);
  uint32_t get_ptr_delta(uint32_t, device_t *);
- bool     is_start_of_packet(device_t *);
+ uint32_t get_frame_length(device_t *);
  void     request_byte(device_t *, uint32_t);
+ bool     request_page(device_t *, uint32_t);
+ bool     request_manifest(device_t *);
+
+ /*==============================================================================
+  *  Background Flash Writer
+  *  Erases and programs run while the cores go on, flash is read under a lock.
+  *==============================================================================*/
+ uint32_t flash_queue_room(device_t *);
+ bool     flash_writer_idle(device_t *);
+ void     lock_flash(device_t *);
+ void     queue_flash_erase(device_t *, uint32_t);
+ void     queue_flash_page(device_t *, uint32_t, const uint8_t *);
+ bool     try_lock_flash(device_t *);
+ void     unlock_flash(device_t *);
+ void     wait_for_flash(device_t *);
 
  /*==============================================================================
   *  Button Interaction
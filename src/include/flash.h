@@ -48,11 +48,37 @@ typedef struct {
 #define STAGING_FIRMWARE_SLOT     1
 #define STAGING_PAGES_CNT         1024
 #define STAGING_IMAGE_SIZE        STAGING_PAGES_CNT * FLASH_PAGE_SIZE
+#define FW_CHUNK_SIZE             32 // Firmware bytes per RESPONSE_CHUNK_MSG, divides FLASH_PAGE_SIZE
+#define FW_CHUNKS_PER_PAGE        (FLASH_PAGE_SIZE / FW_CHUNK_SIZE)
+#define FW_WINDOW_PAGES           2     // Pages requested ahead with REQUEST_PAGE_MSG, see firmware_page_task()
+#define FW_PAGE_TIMEOUT_US        20000 // A requested page that isn't complete by then is requested again
+#define FW_PAGE_COMPLETE          ((1u << FW_CHUNKS_PER_PAGE) - 1) // fw_page_slot_t chunks once all are in
+#define FW_LZ_MIN_MATCH           3     // Shortest match worth a token, see compress_page()
+#define FW_LZ_FRAGMENT_SIZE       60    // Compressed bytes per RESPONSE_PAGE_LZ_MSG
+#define FW_PAGES_PER_SECTOR       (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define FW_SECTORS                (STAGING_IMAGE_SIZE / FLASH_SECTOR_SIZE) // One bit each in a uint64_t
+#define FW_ALL_SECTORS            (FW_SECTORS == 64 ? UINT64_MAX : (1ull << FW_SECTORS) - 1)
+#define FW_MANIFEST_ENTRIES       15    // Sector CRCs per FW_MANIFEST_MSG
+#define FW_MANIFEST_TIMEOUT_US    100000 // Manifest isn't complete by then, it's requested again. It's sent as the CRCs are worked out.
+
+/*==============================================================================
+ *  Background Flash Writer
+ *==============================================================================*/
+
+#define FLASH_QUEUE_LENGTH        4     // Erases and page programs waiting, per producing core
+#define FLASH_WRITER_CORE         0     // Only this core talks to the flash chip, see flash_writer_task()
+#define FLASH_CMD_WRITE_ENABLE    0x06
+#define FLASH_CMD_READ_STATUS     0x05
+#define FLASH_CMD_SECTOR_ERASE    0x20
+#define FLASH_CMD_PAGE_PROGRAM    0x02
+#define FLASH_STATUS_BUSY         0x01  // Erase or program still in progress
 
 /*==============================================================================
 *  Lookup Tables
 *==============================================================================*/
 
+#define CRC32_SNIFFER_MIN_LENGTH  64 // Shorter runs go through crc32_lookup_table, see crc32_update()
+
 extern const uint32_t crc32_lookup_table[];
 
 /*==============================================================================
@@ -52,7 +52,14 @@ void handle_proxy_msg(uart_packet_t *, device_t *);
 void handle_read_config_msg(uart_packet_t *, device_t *);
 void handle_reboot_msg(uart_packet_t *, device_t *);
 void handle_request_byte_msg(uart_packet_t *, device_t *);
+void answer_deferred_byte_request(device_t *);
+void handle_request_page_msg(uart_packet_t *, device_t *);
+void handle_request_manifest_msg(uart_packet_t *, device_t *);
+void handle_fw_manifest_msg(link_packet_t *, device_t *);
 void handle_response_byte_msg(uart_packet_t *, device_t *);
+void handle_response_chunk_msg(link_packet_t *, device_t *);
+void handle_response_page_lz_msg(link_packet_t *, device_t *);
+void handle_mouse_trail_msg(link_packet_t *, device_t *);
 void handle_save_config_msg(uart_packet_t *, device_t *);
 void handle_screensaver_msg(uart_packet_t *, device_t *);
 void handle_set_report_msg(uart_packet_t *, device_t *);
@@ -17,7 +17,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <pico/util/queue.h>
 #include "hid_parser.h"
 
 #include "constants.h"
@@ -48,6 +47,7 @@
 
 
 #include <hardware/structs/ioqspi.h>
+#include <hardware/structs/scb.h>
 #include <hardware/structs/sio.h>
 #include <hardware/dma.h>
 #include <hardware/flash.h>
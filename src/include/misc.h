@@ -18,10 +18,14 @@
  *==============================================================================*/
 
 uint8_t  calc_checksum(const uint8_t *, int);
-uint32_t crc32(const uint8_t *, size_t);
+uint32_t calc_crc32(const uint8_t *, size_t);
 uint32_t crc32_iter(uint32_t, const uint8_t);
+uint32_t crc32_update(uint32_t, const uint8_t *, size_t);
+uint16_t calc_crc16(const uint8_t *, int);
 bool     verify_checksum(const uart_packet_t *);
 
+extern const uint16_t crc16_lookup_table[];
+
 /*==============================================================================
  *  Global State
  *==============================================================================*/
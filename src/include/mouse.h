@@ -23,7 +23,11 @@ void      parse_report_descriptor(hid_interface_t *, uint8_t const *, int);
 /*==============================================================================
  *  Mouse Report Handling
  *==============================================================================*/
+void build_acceleration_table(device_t *);
+enum screen_pos_e update_mouse_position(device_t *, mouse_values_t *);
+int32_t move_and_keep_on_screen(int, int);
 void process_mouse_report(uint8_t *, int, uint8_t, hid_interface_t *);
 void queue_mouse_report(mouse_report_t *, device_t *);
+bool coalesce_mouse_report(mouse_report_t *, const mouse_report_t *);
 bool tud_mouse_report(uint8_t mode, uint8_t buttons, int16_t x, int16_t y, int8_t wheel, int8_t pan);
 void output_mouse_report(mouse_report_t *, device_t *);
@@ -21,6 +21,7 @@
 /* Preamble */
 #define START1        0xAA
 #define START2        0x55
+#define START2_LONG   0x56 // Second preamble byte of a long frame
 #define START_LENGTH  2
 
 /* Packet Queue Definitions  */
@@ -28,6 +29,14 @@
 #define HID_QUEUE_LENGTH   128
 #define KBD_QUEUE_LENGTH   128
 #define MOUSE_QUEUE_LENGTH 512
+#define LINK_QUEUE_LENGTH  16
+
+/* Outgoing packets are sorted into lanes by type, lower lanes are sent first */
+enum uart_lane_e {
+    UART_LANE_INPUT, // Keys, mouse, output switching, anything the user is waiting on
+    UART_LANE_BULK,  // Firmware copy, config and heartbeats
+    NUM_UART_LANES,
+};
 
 /* Packet Lengths and Offsets */
 #define PACKET_LENGTH          (TYPE_LENGTH + PACKET_DATA_LENGTH + CHECKSUM_LENGTH)
@@ -37,6 +46,25 @@
 #define PACKET_DATA_LENGTH      8 // For simplicity, all packet types are the same length
 #define CHECKSUM_LENGTH         1
 
+/* Long frames, sent between boards only when both speak link version 3 or newer:
+   START1 | START2_LONG | len | type | payload[len] | crc16 (MSB first)
+   len is between PACKET_DATA_LENGTH and LINK_MAX_PAYLOAD, so every packet has at least the usual
+   8 bytes of data. The CRC covers len, type and payload. Once the peer accepts them, all packets
+   go out as long frames, regular 12 byte frames are only used with older boards. */
+#define LINK_VERSION            7
+#define LINK_VERSION_LONG       3        // First version that accepts long frames
+#define LINK_VERSION_MOUSE_TRAIL 4       // First version that understands MOUSE_TRAIL_MSG
+#define LINK_VERSION_FW_PAGES   5        // First version that answers REQUEST_PAGE_MSG
+#define LINK_VERSION_FW_LZ      6        // First version that takes pages as RESPONSE_PAGE_LZ_MSG
+#define LINK_VERSION_FW_DELTA   7        // First version that answers REQUEST_MANIFEST_MSG
+#define LINK_PEER_TIMEOUT_US    3000000  // Forget the peer's version if its heartbeats stop
+#define LINK_MAX_PAYLOAD        64
+#define LINK_CRC_LENGTH         2
+#define LINK_CRC_INIT           0xFFFF   // CRC-16/CCITT-FALSE, same as the DMA sniffer's CRC-16-CCITT mode
+#define LINK_HEADER_LENGTH      (START_LENGTH + 1 + TYPE_LENGTH)
+#define LINK_FRAME_LENGTH(len)  (LINK_HEADER_LENGTH + (len) + LINK_CRC_LENGTH)
+#define LINK_MAX_FRAME_LENGTH   LINK_FRAME_LENGTH(LINK_MAX_PAYLOAD)
+
 #define KEYARRAY_BIT_OFFSET     16
 #define KEYS_IN_USB_REPORT      6
 #define KBD_REPORT_LENGTH       8
@@ -44,6 +72,7 @@
 #define CONSUMER_CONTROL_LENGTH 4
 #define SYSTEM_CONTROL_LENGTH   1
 #define MODIFIER_BIT_LENGTH     8
+#define MOUSE_TRAIL_MAX         ((LINK_MAX_PAYLOAD - MOUSE_REPORT_LENGTH - 1) / 2) // Positions after the first one
 
 /*==============================================================================
  *  Data Structures
@@ -58,3 +87,25 @@
     };
     uint8_t checksum; // Checksum, a simple XOR-based one
 } __attribute__((packed)) uart_packet_t;
+
+/* Packet received in a long frame. Starts the same as uart_packet_t, so it goes through the same
+   dispatch, but handlers of long packet types can read up to LINK_MAX_PAYLOAD bytes. */
+typedef struct {
+    uint8_t type;
+    union {
+        uint8_t data[LINK_MAX_PAYLOAD];
+        uint16_t data16[LINK_MAX_PAYLOAD / 2];
+        uint32_t data32[LINK_MAX_PAYLOAD / 4];
+    };
+} __attribute__((packed)) link_packet_t;
+
+typedef struct {
+    uart_packet_t packet;
+    uint32_t queued_at; // time_us_32() when the packet was queued, for latency tracking
+} queued_uart_packet_t;
+
+typedef struct {
+    uint8_t len; // Payload length
+    link_packet_t packet;
+    uint32_t queued_at;
+} queued_link_packet_t;
@@ -36,6 +36,14 @@ enum packet_type_e {
     PROXY_PACKET_MSG     = 23,
     REQUEST_BYTE_MSG     = 24,
     RESPONSE_BYTE_MSG    = 25,
+    RESPONSE_CHUNK_MSG   = 26, // Long frame, address and FW_CHUNK_SIZE bytes of firmware
+    MOUSE_TRAIL_MSG      = 27, // Long frame, several mouse positions, see mouse_trail_t
+    REQUEST_PAGE_MSG     = 28, // Page number, answered with the RESPONSE_CHUNK_MSGs of the whole page
+    RESPONSE_PAGE_LZ_MSG = 29, // Long frame, part of a compressed page, see fw_lz_fragment_t
+    REQUEST_MANIFEST_MSG = 30, // Answered with FW_MANIFEST_MSGs covering every sector
+    FW_MANIFEST_MSG      = 31, // Long frame, CRC32 of some of the sender's sectors, see fw_manifest_t
+
+    PACKET_TYPE_COUNT // Keep last, sizes the tables indexed by packet type
 };
 
 typedef enum {
@@ -61,4 +69,5 @@ typedef struct {
     type_e type;
     uint32_t len;
     size_t offset;
+    bool polled;  // Statistics, read one at a time with GET_VAL and left out of GET_ALL_VALS
 } field_map_t;
@@ -0,0 +1,93 @@
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <hardware/sync.h>
+
+/*==============================================================================
+ *  Lock-free Ring Buffer
+ *
+ *  Exactly one producer and one consumer, which may run on different cores.
+ *  Head and tail are free-running counters, only the producer writes head and
+ *  only the consumer writes tail, so no spinlock is needed. Capacity must be
+ *  a power of two so the counters can wrap on their own.
+ *==============================================================================*/
+
+typedef struct {
+    volatile uint32_t head; // Number of items ever added, written by the producer
+    volatile uint32_t tail; // Number of items ever removed, written by the consumer
+    uint32_t mask;          // Capacity - 1
+    uint32_t item_size;     // Size of one element in bytes
+    uint8_t *items;         // Element storage, placed right after the ring by RING_T
+} ring_t;
+
+/* Declares a ring with inline storage for capacity elements of the given type */
+#define RING_T(type, capacity)                                                      \
+    struct {                                                                        \
+        ring_t ring;                                                                \
+        type items[capacity];                                                       \
+        _Static_assert(((capacity) & ((capacity) - 1)) == 0, "Capacity must be 2^n"); \
+    }
+
+#define ring_init(q) \
+    ring_setup(&(q)->ring, (uint8_t *)(q)->items, sizeof((q)->items[0]), sizeof((q)->items) / sizeof((q)->items[0]))
+
+static inline void ring_setup(ring_t *ring, uint8_t *items, uint32_t item_size, uint32_t capacity) {
+    ring->head      = 0;
+    ring->tail      = 0;
+    ring->mask      = capacity - 1;
+    ring->item_size = item_size;
+    ring->items     = items;
+}
+
+static inline uint32_t ring_level(const ring_t *ring) {
+    return ring->head - ring->tail;
+}
+
+static inline bool ring_is_full(const ring_t *ring) {
+    return ring_level(ring) > ring->mask;
+}
+
+/* Producer side. Copies the item in and publishes it only once the copy is complete, then wakes
+   the other core in case it's waiting in __wfe() for work, like queue_t used to. */
+static inline bool ring_try_add(ring_t *ring, const void *item) {
+    uint32_t head = ring->head;
+
+    if (head - ring->tail > ring->mask)
+        return false;
+
+    memcpy(&ring->items[(head & ring->mask) * ring->item_size], item, ring->item_size);
+    __dmb();
+
+    ring->head = head + 1;
+    __sev();
+    return true;
+}
+
+/* Consumer side. Returns the oldest item in place, or NULL if empty. It stays valid until ring_pop(). */
+static inline void *ring_peek(ring_t *ring) {
+    uint32_t tail = ring->tail;
+
+    if (ring->head == tail)
+        return NULL;
+
+    __dmb();
+    return &ring->items[(tail & ring->mask) * ring->item_size];
+}
+
+/* Consumer side. Releases the slot returned by ring_peek() back to the producer. */
+static inline void ring_pop(ring_t *ring) {
+    __dmb();
+    ring->tail = ring->tail + 1;
+}
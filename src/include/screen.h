@@ -30,6 +30,11 @@ typedef struct {
                 // height
 } border_size_t;
 
+typedef struct {
+    uint16_t value;  // Movement magnitude where this point is located
+    uint16_t factor; // Acceleration factor at that magnitude, Q12 fixed point
+} accel_point_t;
+
 typedef struct {
     uint8_t mode;
     uint8_t only_if_inactive;
@@ -48,4 +53,5 @@ typedef struct {
     uint8_t pos;               // Screen position on this output
     uint8_t mouse_park_pos;    // Where the mouse goes after switch
     screensaver_t screensaver; // Screensaver parameters for this output
+    accel_point_t accel_curve[ACCEL_POINTS]; // Mouse acceleration curve for this output
 } output_t;
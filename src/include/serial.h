@@ -23,12 +23,21 @@
 #define SERIAL_STOP_BITS  1
 #define SERIAL_UART       uart0
 
+/* Time the given number of bytes takes on the wire, 10 bits each (start, 8 data, stop), rounded up */
+#define UART_BYTES_TIME_US(n) (((uint64_t)(n) * 10 * 1000000 + SERIAL_BAUDRATE - 1) / SERIAL_BAUDRATE)
+
 /*==============================================================================
  *  Serial Communication Functions
  *==============================================================================*/
 
 bool get_packet_from_buffer(device_t *);
 void process_packet(uart_packet_t *, device_t *);
+void dispatch_packet(uart_packet_t *, device_t *);
 void queue_packet(const uint8_t *, enum packet_type_e, int);
+ring_t *get_uart_tx_queue(device_t *, enum packet_type_e);
+bool queue_uart_packet(device_t *, uart_packet_t *);
 void send_value(const uint8_t, enum packet_type_e);
 void write_raw_packet(uint8_t *, uart_packet_t *);
+int write_raw_link_packet(uint8_t *, queued_link_packet_t *);
+bool queue_link_packet(const uint8_t *, enum packet_type_e, int);
+bool peer_supports_long_frames(device_t *);
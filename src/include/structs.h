@@ -13,15 +13,11 @@
 #include <stdint.h>
 #include "flash.h"
 #include "packet.h"
+#include "ring.h"
 #include "screen.h"
 
 typedef void (*action_handler_t)();
 
-typedef struct { // Maps message type -> message handler function
-    enum packet_type_e type;
-    action_handler_t handler;
-} uart_handler_t;
-
 typedef struct {
     uint8_t modifier;                 // Which modifier is pressed
     uint8_t keys[KEYS_IN_USB_REPORT]; // Which keys need to be pressed
@@ -40,6 +36,20 @@ typedef struct TU_ATTR_PACKED {
     uint8_t mode;
 } mouse_report_t;
 
+/* Payload of MOUSE_TRAIL_MSG. The first report carries the buttons, mode and all of the wheel and pan
+   movement, each following position is a delta from the one before it. In relative mode the deltas
+   are simply the movements. */
+typedef struct TU_ATTR_PACKED {
+    mouse_report_t report;
+    uint8_t count;                     // How many deltas follow
+    int8_t delta[MOUSE_TRAIL_MAX][2];  // x, y
+} mouse_trail_t;
+
+typedef struct {
+    mouse_report_t report;
+    uint32_t queued_at; // time_us_32() when the report was queued, for latency tracking
+} queued_mouse_report_t;
+
 typedef struct {
     uint8_t tip_pressure;
     uint8_t buttons; // Digitizer buttons
@@ -57,14 +67,78 @@ typedef struct {
 
 typedef enum { IDLE, READING_PACKET, PROCESSING_PACKET } receiver_state_t;
 
+/* Payload of RESPONSE_PAGE_LZ_MSG, a piece of a page compressed with compress_page() */
+typedef struct TU_ATTR_PACKED {
+    uint16_t page;
+    uint8_t length; // Compressed size of the whole page, always less than FLASH_PAGE_SIZE
+    uint8_t offset; // Where in the compressed page this piece goes
+    uint8_t data[FW_LZ_FRAGMENT_SIZE];
+} fw_lz_fragment_t;
+
+/* Payload of FW_MANIFEST_MSG, CRC32 of each flash sector in a part of the sender's running image */
+typedef struct TU_ATTR_PACKED {
+    uint8_t first; // Sector of crc[0]
+    uint8_t count;
+    uint32_t crc[FW_MANIFEST_ENTRIES];
+} fw_manifest_t;
+
+/* Erase or page program for the background writer, command is sent to the chip as is: opcode and
+   24 bit flash offset, followed by data for a page program */
+typedef struct {
+    uint8_t command[4];
+    uint8_t data[FLASH_PAGE_SIZE];
+} flash_job_t;
+
+typedef struct {
+    volatile bool busy;                 // Chip is working on the job at the head of queue[core], flash can't be read
+    volatile bool reading[NUM_CORES];   // Core is reading flash, no job starts until it's done
+    uint8_t core;                       // Queue of the job in flight
+    uint32_t jobs;                      // Jobs completed
+} flash_writer_t;
+
+/* A page requested from the other board, filled in as its chunks arrive */
+typedef struct {
+    uint32_t page;
+    uint8_t chunks;        // Bit n set once chunk n (or fragment n, if compressed) is in
+    uint8_t expected;      // What chunks has to be for the page to be complete
+    uint8_t length;        // Compressed size if it comes as RESPONSE_PAGE_LZ_MSG, data is then compressed
+    uint32_t requested_us; // time_us_32() of the last request, for the retry timeout
+    uint8_t data[FLASH_PAGE_SIZE];
+} fw_page_slot_t;
+
 typedef struct {
     uint32_t address;         // Address we're sending to the other box
     uint32_t checksum;
     uint16_t version;
     bool byte_done;           // Has the byte been successfully transferred
     bool upgrade_in_progress; // True if firmware transfer from the other box is in progress
+
+    /* Streaming whole pages, with boards that answer REQUEST_PAGE_MSG */
+    bool paged;
+    uint32_t next_page;       // Next page to request, the ones from address on are in the window
+    fw_page_slot_t window[FW_WINDOW_PAGES];
+    uint32_t started_us;      // When the transfer started
+    uint32_t transfer_us;     // How long the last completed transfer took
+    uint32_t retransmits;     // Pages requested again after a timeout
+
+    /* Delta sync, with boards that answer REQUEST_MANIFEST_MSG */
+    bool manifest_pending;          // Waiting for the other board's sector CRCs before streaming
+    uint32_t manifest_requested_us;
+    uint64_t manifest_received;     // Bit n set once the CRC of sector n is in
+    uint32_t peer_crc[FW_SECTORS];  // -||-, compared with ours by firmware_page_task()
+    uint64_t same_sectors;          // Bit n set if sector n is the same on both, it's neither sent nor written
+    uint32_t skipped_pages;
+    uint64_t erased_sectors;        // Bit n set once the erase of sector n is queued
 } fw_upgrade_state_t;
 
+/* CRC32 of each sector of our own image, for delta sync. Worked out a sector at a time by
+   update_sector_crcs() and kept until the flash writer starts a job on that sector. */
+typedef struct {
+    uint32_t crc[FW_SECTORS];
+    uint64_t valid;  // Bit n set once crc[n] is known
+    uint64_t unsent; // Bit n set while crc[n] still has to go to the other board, see send_manifest()
+} sector_crcs_t;
+
 typedef struct {
     uint32_t magic_header;
     uint32_t version;
@@ -86,6 +160,22 @@ typedef struct {
     uint32_t checksum;
 } config_t;
 
+typedef struct {
+    uint32_t run_count;   // How many times the task ran
+    uint32_t exec_min_us; // Shortest execution time
+    uint32_t exec_max_us; // Longest execution time
+    uint32_t exec_avg_us; // Average execution time
+    uint32_t late_max_us; // Worst start latency past the deadline (periodic tasks only)
+    uint32_t late_avg_us; // Average start latency past the deadline (periodic tasks only)
+    int32_t exec_avg_q4;  // Moving averages are kept in 1/16 us, so short tasks don't round to 0
+    int32_t late_avg_q4;
+} task_stats_t;
+
+typedef struct {
+    uint32_t depth_max;      // Most packets ever waiting in the lane, both cores together
+    uint32_t latency_us;     // Age of the lane's oldest packet in the last transfer, when it started
+    uint32_t latency_max_us; // Worst of those
+} uart_lane_stats_t;
 
 /*==============================================================================
  *  Device State
@@ -108,28 +198,73 @@ typedef struct {
     int16_t pointer_y;
     int16_t mouse_buttons; // Store and update the state of mouse buttons
 
+    int32_t residual_x[NUM_SCREENS]; // Sub-pixel movement (Q12) carried over between reports, per output
+    int32_t residual_y[NUM_SCREENS];
+
+    uint16_t accel_lut[NUM_SCREENS][ACCEL_LUT_SIZE]; // Acceleration factor (Q12) per output, indexed by squared movement magnitude
+
     config_t config;       // Device configuration, loaded from flash or defaults used
-    queue_t hid_queue_out; // Queue that stores outgoing hid messages
-    queue_t kbd_queue;     // Queue that stores keyboard reports
-    queue_t mouse_queue;   // Queue that stores mouse reports
-    queue_t uart_tx_queue; // Queue that stores outgoing packets
+    RING_T(hid_generic_pkt_t, HID_QUEUE_LENGTH) hid_queue_out[NUM_CORES]; // Outgoing hid messages, one per producing core
+    RING_T(hid_keyboard_report_t, KBD_QUEUE_LENGTH) kbd_queue;            // Keyboard reports, core1 -> core0
+    RING_T(queued_mouse_report_t, MOUSE_QUEUE_LENGTH) mouse_queue;        // Mouse reports, core1 -> core0
+    RING_T(queued_uart_packet_t, UART_QUEUE_LENGTH) uart_tx_queue[NUM_CORES][NUM_UART_LANES]; // Outgoing packets, per producing core and lane
+    RING_T(queued_link_packet_t, LINK_QUEUE_LENGTH) link_tx_queue[NUM_CORES]; // Outgoing long packets, -||-
+    RING_T(flash_job_t, FLASH_QUEUE_LENGTH) flash_queue[NUM_CORES];         // Flash erases and programs, -||-
+    flash_writer_t flash;                                                   // Background flash writer
 
     hid_interface_t iface[MAX_DEVICES][MAX_INTERFACES]; // Store info about HID interfaces
-    uart_packet_t in_packet;
+    uint8_t in_frame[LINK_MAX_FRAME_LENGTH] __attribute__((aligned(4))); // Received frame that wrapped around the end of the DMA ring, put back together
 
     /* DMA */
     uint32_t dma_ptr;             // Stores info about DMA ring buffer last checked position
     uint32_t dma_rx_channel;      // DMA RX channel we're using to receive
     uint32_t dma_control_channel; // DMA channel that controls the RX transfer channel
     uint32_t dma_tx_channel;      // DMA TX channel we're using to send
+    uint8_t uart_tx_fill;         // Which of the two TX buffers is being filled, the other one may be sending
+    uint16_t uart_tx_staged;      // Bytes waiting in the fill buffer
+    uint8_t uart_tx_lanes_staged; // Bit per lane that has packets in the fill buffer
+    uint32_t uart_tx_oldest[NUM_UART_LANES]; // queued_at of each lane's oldest packet in the fill buffer
+    uart_lane_stats_t uart_tx_lane_stats[NUM_UART_LANES]; // Depth and latency of the outgoing lanes
+    queued_uart_packet_t uart_tx_mouse; // Mouse packet held back while the line is busy, newer ones merge into it
+    bool uart_tx_mouse_valid;
+    uint8_t uart_tx_mouse_count;        // Positions added to it as deltas, see mouse_trail_t
+    int8_t uart_tx_mouse_trail[MOUSE_TRAIL_MAX][2];
+    int16_t uart_tx_mouse_x;            // Last position in it
+    int16_t uart_tx_mouse_y;
+    uint32_t uart_tx_mouse_merged;      // Mouse packets that didn't have to be sent thanks to that
+    uint32_t uart_tx_mouse_packed;      // Mouse packets sent as deltas in a trail
+
+    /* UART receiver */
+    uint32_t uart_rx_packets;     // Packets handled in the last receiver pass that found any
+    uint32_t uart_rx_packets_max; // Most packets handled in a single pass
+    uint32_t uart_rx_level_max;   // Most unread bytes ever seen waiting in the DMA ring
+    uint32_t uart_rx_needed;      // Bytes the frame at dma_ptr needs before it can be handled
+    uint8_t uart_rx_payload_len;  // Data length of the packet being handled
+    uint32_t uart_rx_arrival_us;  // When the RX line woke us up, i.e. the first start bit of a burst
+    bool uart_rx_arrival_valid;   // Set by the wakeup interrupt, cleared once the first packet is handled
+    uint32_t uart_rx_latency_us;  // From the wakeup edge to the first packet of that burst being handled
+    uint32_t uart_rx_latency_max_us;
+    uint32_t uart_rx_count[PACKET_TYPE_COUNT]; // Packets received, per type
+    uint32_t uart_rx_rejected;    // Packets of a type we have no handler for
+    uint32_t uart_rx_crc_errors;      // Long frames dropped for a bad CRC
+    uint32_t uart_rx_checksum_errors; // Regular frames dropped, bad checksum or the peer uses long frames
+    uint32_t uart_rx_skipped_bytes;   // Bytes skipped while looking for the start of a frame
 
     /* Firmware */
     fw_upgrade_state_t fw;           // State of the firmware upgrader
+    sector_crcs_t sector_crcs;       // Our image's sector CRCs, for the other board's manifest and our own
     firmware_metadata_t _running_fw; // RAM copy of running fw metadata
     bool reboot_requested;           // If set, stop updating watchdog
     uint64_t config_mode_timer;      // Counts how long are we to remain in config mode
 
     uint8_t page_buffer[FLASH_PAGE_SIZE]; // For firmware-over-serial upgrades
+    uart_packet_t byte_request;           // REQUEST_BYTE_MSG that came while our flash was being written
+    bool byte_request_deferred;           // -||- is waiting to be answered
+
+    /* Link to the other board */
+    uint8_t peer_link_version;   // Link version the other board announced in its last heartbeat
+    uint64_t peer_heartbeat_us;  // When that heartbeat arrived
+    bool peer_long_frames;       // Good long frames came in since the other board's last regular heartbeat
 
     /* Connection status flags */
     bool tud_connected;      // True when TinyUSB device successfully connects
@@ -140,6 +275,12 @@ typedef struct {
     bool switch_lock;        // True when device is prevented from switching
     bool onboard_led_state;  // True when LED is ON
     bool relative_mouse;     // True when relative mouse mode is used
+
+    /* Mouse reports merged while the host endpoint was busy */
+    queued_mouse_report_t mouse_pending; // Coalesced report waiting to be sent, queued_at is the oldest one merged
+    bool mouse_pending_valid;            // True if mouse_pending holds a report
+    uint32_t mouse_latency_us;           // Age of the oldest mouse report not yet sent to the host
+    uint32_t mouse_latency_max_us;       // Worst age of a mouse report at the time it was sent
     bool gaming_mode;        // True when gaming mode is on (relative passthru + lock)
     bool config_mode_active; // True when config mode is active
     bool digitizer_active;   // True when digitizer Win/Mac workaround is active
@@ -147,17 +288,45 @@ typedef struct {
     /* Onboard LED blinky (provide feedback when e.g. mouse connected) */
     int32_t blinks_left;     // How many blink transitions are left
     int32_t last_led_change; // Timestamp of the last time led state transitioned
+
+    /* Scheduler profiling, per core and per task */
+    task_stats_t task_stats[NUM_CORES][MAX_TASKS_PER_CORE];
 } device_t;
 /*==============================================================================*/
 
 
+/* Events that can make a task runnable. Tasks without any only run on their timer. */
+enum wake_source_e {
+    WAKE_TIMER       = 0,
+    WAKE_USB_DEVICE  = (1 << 0), // TinyUSB device stack has events to process
+    WAKE_USB_HOST    = (1 << 1), // TinyUSB host stack has events to process
+    WAKE_KBD_QUEUE   = (1 << 2), // Keyboard queue is not empty
+    WAKE_MOUSE_QUEUE = (1 << 3), // Mouse queue is not empty
+    WAKE_HID_QUEUE   = (1 << 4), // Outgoing HID queue is not empty
+    WAKE_UART_TX     = (1 << 5), // Packets are waiting to be sent over UART
+    WAKE_UART_RX     = (1 << 6), // DMA received at least a packet worth of bytes
+    WAKE_FW_UPGRADE  = (1 << 7), // Firmware transfer is ready for the next request
+    WAKE_FLASH       = (1 << 8), // Flash jobs are queued or one is in progress
+};
+
 typedef struct {
     void (*exec)(device_t *state);
     uint64_t frequency;
     uint64_t next_run;
     bool *enabled;
+    uint32_t wake_on;  // Wake sources (wake_source_e) this task waits for, WAKE_TIMER if none
+    uint32_t overruns; // How many periods were skipped because the task started too late
+    task_stats_t *stats; // Execution time and jitter profile, lives in device_t so the API can read it
 } task_t;
 
+typedef struct {
+    task_t *tasks;                      // All tasks running on this core
+    int num_tasks;
+    task_t *timers[MAX_TASKS_PER_CORE]; // Min-heap of timer-only tasks, ordered by next_run
+    int num_timers;
+    uint32_t wake_on;                   // Wake sources any of our tasks are waiting for
+} scheduler_t;
+
 enum os_type_e {
     LINUX   = 1,
     MACOS   = 2,
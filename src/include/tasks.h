@@ -16,13 +16,16 @@
  *  Core Task Scheduling
  *==============================================================================*/
 
- void task_scheduler(device_t *, task_t *);
+ void scheduler_init(scheduler_t *, task_t *, int, task_stats_t *);
+ void task_scheduler(device_t *, scheduler_t *);
+ void uart_rx_wakeup_init(device_t *);
 
 /*==============================================================================
  *  Individual Task Functions
  *==============================================================================*/
 
 void firmware_upgrade_task(device_t *);
+void flash_writer_task(device_t *);
 void heartbeat_output_task(device_t *);
 void kick_watchdog_task(device_t *);
 void led_blinking_task(device_t *);
@@ -197,14 +197,13 @@ void combine_kbd_states(device_t *state, hid_keyboard_report_t *combined_report)
  * ==================================================== */
 
 void process_kbd_queue_task(device_t *state) {
-    hid_keyboard_report_t report;
-
     /* If we're not connected, we have nowhere to send reports to. */
     if (!state->tud_connected)
         return;
 
     /* Peek first, if there is anything there... */
-    if (!queue_try_peek(&state->kbd_queue, &report))
+    hid_keyboard_report_t *report = ring_peek(&state->kbd_queue.ring);
+    if (!report)
         return;
 
     /* If we are suspended, let's wake the host up */
@@ -216,11 +215,11 @@ void process_kbd_queue_task(device_t *state) {
         return;
 
     /* ... try sending it to the host, if it's successful */
-    bool succeeded = tud_hid_keyboard_report(REPORT_ID_KEYBOARD, report.modifier, report.keycode);
+    bool succeeded = tud_hid_keyboard_report(REPORT_ID_KEYBOARD, report->modifier, report->keycode);
 
-    /* ... then we can remove it from the queue. Race conditions shouldn't happen [tm] */
+    /* ... then we can remove it from the queue, nobody else moves the tail */
     if (succeeded)
-        queue_try_remove(&state->kbd_queue, &report);
+        ring_pop(&state->kbd_queue.ring);
 }
 
 void queue_kbd_report(hid_keyboard_report_t *report, device_t *state) {
@@ -228,7 +227,7 @@ void queue_kbd_report(hid_keyboard_report_t *report, device_t *state) {
     if (!state->tud_connected)
         return;
 
-    queue_try_add(&state->kbd_queue, report);
+    ring_try_add(&state->kbd_queue.ring, report);
 }
 
 void release_all_keys(device_t *state) {
@@ -240,7 +239,7 @@ void release_all_keys(device_t *state) {
     }
 
     /* Send a report with no keys pressed */
-    queue_try_add(&state->kbd_queue, &no_keys_pressed_report);
+    queue_kbd_report(&no_keys_pressed_report, state);
 }
 
 /* If keys need to go locally, queue packet to kbd queue, else send them through UART */
@@ -21,14 +21,16 @@ int main(void) {
     /* 定义 core0 的任务数组。数组元素为 task_t 结构，包含要执行的函数指针与频率。
        _TOP() 表示尽可能频繁运行，_HZ(x) 表示以 x 次/秒 的周期运行（通过微秒来计算下次运行时间）。 */
     static task_t tasks_core0[] = {
-        [0] = {.exec = &usb_device_task,          .frequency = _TOP()},      // .-> USB device task, needs to run as often as possible
-        [1] = {.exec = &kick_watchdog_task,       .frequency = _HZ(30)},     // | Verify core1 is still running and if so, reset watchdog timer
-        [2] = {.exec = &process_kbd_queue_task,   .frequency = _HZ(2000)},   // | Check if there were any keypresses and send them
-        [3] = {.exec = &process_mouse_queue_task, .frequency = _HZ(2000)},   // | Check if there were any mouse movements and send them
-        [4] = {.exec = &process_hid_queue_task,   .frequency = _HZ(1000)},   // | Check if there are any packets to send over vendor link
-        [5] = {.exec = &process_uart_tx_task,     .frequency = _TOP()},      // | Check if there are any packets to send over UART
-    };                                                                       // `----- then go back and repeat forever
+        [0] = {.exec = &usb_device_task,          .frequency = _TOP(),     .wake_on = WAKE_USB_DEVICE},  // .-> USB device task, needs to run as often as possible
+        [1] = {.exec = &kick_watchdog_task,       .frequency = _HZ(30),    .wake_on = WAKE_TIMER},       // | Verify core1 is still running and if so, reset watchdog timer
+        [2] = {.exec = &process_kbd_queue_task,   .frequency = _HZ(2000),  .wake_on = WAKE_KBD_QUEUE},   // | Check if there were any keypresses and send them
+        [3] = {.exec = &process_mouse_queue_task, .frequency = _HZ(2000),  .wake_on = WAKE_MOUSE_QUEUE}, // | Check if there were any mouse movements and send them
+        [4] = {.exec = &process_hid_queue_task,   .frequency = _HZ(1000),  .wake_on = WAKE_HID_QUEUE},   // | Check if there are any packets to send over vendor link
+        [5] = {.exec = &process_uart_tx_task,     .frequency = _TOP(),     .wake_on = WAKE_UART_TX},     // | Check if there are any packets to send over UART
+        [6] = {.exec = &flash_writer_task,        .frequency = _HZ(2000),  .wake_on = WAKE_FLASH},       // | Erase and program flash in the background (FLASH_WRITER_CORE)
+    };                                                                                                  // `----- then sleep until the next event or deadline
     const int NUM_TASKS = ARRAY_SIZE(tasks_core0); /* 当前 core0 任务数量 */
+    static scheduler_t scheduler_core0;
 
     // Wait for the board to settle
     sleep_ms(10); /* 简短延时，等待电源/外设稳定 */
@@ -39,30 +41,35 @@ int main(void) {
     // Initial state, A is the default output
     set_active_output(device, OUTPUT_A); /* 初始激活输出为 OUTPUT_A（A 板输出） */
 
-    while (true) {
-        for (int i = 0; i < NUM_TASKS; i++)
-            task_scheduler(device, &tasks_core0[i]); /* 轮询任务调度器，按每个任务的 next_run 时间执行 */
-    }
+    scheduler_init(&scheduler_core0, tasks_core0, NUM_TASKS, device->task_stats[0]); /* 定时任务按截止时间建堆 */
+
+    while (true)
+        task_scheduler(device, &scheduler_core0); /* 运行到期/有事件的任务，空闲时休眠 */
 }
 
 void core1_main() {
     /* core1 的任务列表，通常负责 USB Host、串口接收、LED 与定时器相关任务 */
     static task_t tasks_core1[] = {
-        [0] = {.exec = &usb_host_task,           .frequency = _TOP()},       // .-> USB host task, needs to run as often as possible
-        [1] = {.exec = &packet_receiver_task,    .frequency = _TOP()},       // | Receive data over serial from the other board
-        [2] = {.exec = &led_blinking_task,       .frequency = _HZ(30)},      // | Check if LED needs blinking
-        [3] = {.exec = &screensaver_task,        .frequency = _HZ(120)},     // | Handle "screensaver" movements
-        [4] = {.exec = &firmware_upgrade_task,   .frequency = _HZ(4000)},    // | Send firmware to the other board if needed
-        [5] = {.exec = &heartbeat_output_task,   .frequency = _HZ(1)},       // | Output periodic heartbeats
-    };                                                                       // `----- then go back and repeat forever
+        [0] = {.exec = &usb_host_task,           .frequency = _TOP(),      .wake_on = WAKE_USB_HOST},    // .-> USB host task, needs to run as often as possible
+        [1] = {.exec = &packet_receiver_task,    .frequency = _TOP(),      .wake_on = WAKE_UART_RX},     // | Receive data over serial from the other board
+        [2] = {.exec = &led_blinking_task,       .frequency = _HZ(30),     .wake_on = WAKE_TIMER},       // | Check if LED needs blinking
+        [3] = {.exec = &screensaver_task,        .frequency = _HZ(120),    .wake_on = WAKE_TIMER},       // | Handle "screensaver" movements
+        [4] = {.exec = &firmware_upgrade_task,   .frequency = _HZ(4000),   .wake_on = WAKE_FW_UPGRADE},  // | Send firmware to the other board if needed
+        [5] = {.exec = &heartbeat_output_task,   .frequency = _HZ(1),      .wake_on = WAKE_TIMER},       // | Output periodic heartbeats
+    };                                                                                                  // `----- then sleep until the next event or deadline
     const int NUM_TASKS = ARRAY_SIZE(tasks_core1);
+    static scheduler_t scheduler_core1;
+
+    /* Pending interrupts wake this core from __wfe() too, and so does incoming UART data */
+    scb_hw->scr |= M0PLUS_SCR_SEVONPEND_BITS; /* SCR 是每个核心独立的，core1 需要单独设置 */
+    uart_rx_wakeup_init(device);
+    scheduler_init(&scheduler_core1, tasks_core1, NUM_TASKS, device->task_stats[1]);
 
     while (true) {
         // Update the timestamp, so core0 can figure out if we're dead
         device->core1_last_loop_pass = time_us_64(); /* 更新 core1 的心跳时间戳，供 core0 的看门狗任务检查 */
 
-        for (int i = 0; i < NUM_TASKS; i++)
-            task_scheduler(device, &tasks_core1[i]); /* 轮询并执行 core1 的任务 */
+        task_scheduler(device, &scheduler_core1); /* 运行 core1 到期/有事件的任务，空闲时休眠 */
     }
 }
 /* =======  End of Main Program Loops  ======= */
@@ -10,11 +10,9 @@
  */
 
 #include "main.h"
-#include <math.h>
 
 #define MACOS_SWITCH_MOVE_X 10
 #define MACOS_SWITCH_MOVE_COUNT 5
-#define ACCEL_POINTS 7
 
 /* Check if our upcoming mouse movement would result in having to switch outputs */
 enum screen_pos_e is_screen_switch_needed(int position, int offset) {
@@ -41,57 +39,93 @@ int32_t move_and_keep_on_screen(int position, int offset) {
     return position + offset;
 }
 
-/* Implement basic mouse acceleration based on actual 2D movement magnitude.
-   Returns the acceleration factor to apply to both x and y components. */
-float calculate_mouse_acceleration_factor(int32_t offset_x, int32_t offset_y) {
-    const struct curve {
-        int value;
-        float factor;
-    } acceleration[ACCEL_POINTS] = {
-                   // 4 |                                        *
-        {2, 1},    //   |                                  *
-        {5, 1.1},  // 3 |
-        {15, 1.4}, //   |                       *
-        {30, 1.9}, // 2 |                *
-        {45, 2.6}, //   |        *
-        {60, 3.4}, // 1 |  *
-        {70, 4.0}, //    -------------------------------------------
-    };             //        10    20    30    40    50    60    70
-
-    if (offset_x == 0 && offset_y == 0)
-        return 1.0;
-
-    if (!global_state.config.enable_acceleration)
-        return 1.0;
-
-    // Calculate the 2D movement magnitude
-    const float movement_magnitude = sqrtf((float)(offset_x * offset_x) + (float)(offset_y * offset_y));
-
-    if (movement_magnitude <= acceleration[0].value)
-        return acceleration[0].factor;
-
-    if (movement_magnitude >= acceleration[ACCEL_POINTS-1].value)
-        return acceleration[ACCEL_POINTS-1].factor;
-
-    const struct curve *lower = NULL;
-    const struct curve *upper = NULL;
-
-    for (int i = 0; i < ACCEL_POINTS-1; i++) {
-        if (movement_magnitude < acceleration[i + 1].value) {
-            lower = &acceleration[i];
-            upper = &acceleration[i + 1];
-            break;
+/* Integer square root, only used when building the table so it doesn't need to be fast */
+static uint32_t isqrt(uint32_t n) {
+    uint32_t root = 0, bit = 1u << 30;
+
+    while (bit > n)
+        bit >>= 2;
+
+    while (bit) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        } else
+            root >>= 1;
+        bit >>= 2;
+    }
+
+    return root;
+}
+
+/* Linear interpolation between the two curve points surrounding magnitude (in Q8) */
+static uint16_t interpolate_acceleration(const accel_point_t *curve, uint32_t magnitude) {
+    if (magnitude <= (uint32_t)curve[0].value << 8)
+        return curve[0].factor;
+
+    for (int i = 0; i < ACCEL_POINTS - 1; i++) {
+        const accel_point_t *lower = &curve[i];
+        const accel_point_t *upper = &curve[i + 1];
+
+        /* Also skips over points that aren't in ascending order, we can't divide by those */
+        if (magnitude >= (uint32_t)upper->value << 8 || upper->value <= lower->value)
+            continue;
+
+        if (magnitude <= (uint32_t)lower->value << 8)
+            return lower->factor;
+
+        int32_t position = magnitude - (lower->value << 8);
+        int32_t span     = (upper->value - lower->value) << 8;
+
+        return lower->factor + ((int64_t)position * (upper->factor - lower->factor)) / span;
+    }
+
+    return curve[ACCEL_POINTS - 1].factor;
+}
+
+/* Precompile each output's curve into a factor for every squared movement magnitude. This runs
+   when config is loaded or changed, so the per-report cost is a single table lookup regardless
+   of the curve shape, instead of soft-float sqrtf and interpolation. */
+void build_acceleration_table(device_t *state) {
+    for (int out = 0; out < NUM_SCREENS; out++) {
+        const accel_point_t *curve = state->config.output[out].accel_curve;
+
+        for (uint32_t i = 0; i < ACCEL_LUT_SIZE; i++) {
+            /* Sample in the middle of the bucket, isqrt of a Q16 value gives us magnitude in Q8 */
+            uint32_t magnitude_sq    = (i << ACCEL_LUT_SHIFT) + ((1 << ACCEL_LUT_SHIFT) >> 1);
+            state->accel_lut[out][i] = interpolate_acceleration(curve, isqrt(magnitude_sq << 16));
         }
     }
+}
+
+/* Implement basic mouse acceleration based on actual 2D movement magnitude.
+   Returns the acceleration factor (Q12) to apply to both x and y components. */
+static inline uint32_t calculate_mouse_acceleration_factor(device_t *state, int32_t offset_x, int32_t offset_y) {
+    const uint16_t *table = state->accel_lut[state->active_output];
+
+    if (!state->config.enable_acceleration)
+        return ACCEL_ONE;
+
+    /* Way past the last curve point, also keeps the squares below from overflowing */
+    if (abs(offset_x) > INT16_MAX || abs(offset_y) > INT16_MAX)
+        return table[ACCEL_LUT_SIZE - 1];
+
+    uint32_t index = (uint32_t)(offset_x * offset_x + offset_y * offset_y) >> ACCEL_LUT_SHIFT;
 
-    // Should never happen, but just in case
-    if (lower == NULL || upper == NULL)
-        return 1.0;
+    if (index >= ACCEL_LUT_SIZE)
+        index = ACCEL_LUT_SIZE - 1;
 
-    const float interpolation_pos = (movement_magnitude - lower->value) /
-                                  (upper->value - lower->value);
+    return table[index];
+}
+
+/* Apply acceleration (Q12) and speed to movement. Whatever doesn't amount to a whole pixel is kept
+   in the residual and carried over to the next report, so slow movement doesn't get rounded away. */
+static inline int32_t scale_movement(int32_t move, uint32_t acceleration, int32_t speed, uint8_t reduce_speed, int32_t *residual) {
+    int64_t scaled = (((int64_t)move * speed * acceleration) >> reduce_speed) + *residual;
+    int32_t offset = (scaled + (1 << (ACCEL_FRAC_BITS - 1))) >> ACCEL_FRAC_BITS;
 
-    return lower->factor + interpolation_pos * (upper->factor - lower->factor);
+    *residual = scaled - ((int64_t)offset << ACCEL_FRAC_BITS);
+    return offset;
 }
 
 /* Returns LEFT if need to jump left, RIGHT if right, NONE otherwise */
@@ -104,9 +138,11 @@ enum screen_pos_e update_mouse_position(device_t *state, mouse_values_t *values)
         reduce_speed = MOUSE_ZOOM_SCALING_FACTOR;
 
     /* Calculate movement */
-    float acceleration_factor = calculate_mouse_acceleration_factor(values->move_x, values->move_y);
-    int offset_x = round(values->move_x * acceleration_factor * (current->speed_x >> reduce_speed));
-    int offset_y = round(values->move_y * acceleration_factor * (current->speed_y >> reduce_speed));
+    uint32_t acceleration_factor = calculate_mouse_acceleration_factor(state, values->move_x, values->move_y);
+    int offset_x = scale_movement(values->move_x, acceleration_factor, current->speed_x, reduce_speed,
+                                  &state->residual_x[state->active_output]);
+    int offset_y = scale_movement(values->move_y, acceleration_factor, current->speed_y, reduce_speed,
+                                  &state->residual_y[state->active_output]);
 
     /* Determine if our upcoming movement would stay within the screen */
     enum screen_pos_e switch_direction = is_screen_switch_needed(state->pointer_x, offset_x);
@@ -342,16 +378,63 @@ void process_mouse_report(uint8_t *raw_report, int len, uint8_t itf, hid_interfa
  * Mouse Queue Section
  * ==================================================== */
 
+/* Merge next into pending, unless that would lose something. Button changes need to reach
+ * the host as separate reports and the sums have to fit into the report fields. */
+bool coalesce_mouse_report(mouse_report_t *pending, const mouse_report_t *next) {
+    if (next->mode != pending->mode || next->buttons != pending->buttons)
+        return false;
+
+    int32_t wheel = pending->wheel + next->wheel;
+    int32_t pan   = pending->pan + next->pan;
+
+    if (wheel < INT8_MIN || wheel > INT8_MAX || pan < INT8_MIN || pan > INT8_MAX)
+        return false;
+
+    /* Absolute position simply takes the latest one, relative movement adds up */
+    if (next->mode == RELATIVE) {
+        int32_t x = pending->x + next->x;
+        int32_t y = pending->y + next->y;
+
+        if (x < -INT16_MAX || x > INT16_MAX || y < -INT16_MAX || y > INT16_MAX)
+            return false;
+
+        pending->x = x;
+        pending->y = y;
+    } else {
+        pending->x = next->x;
+        pending->y = next->y;
+    }
+
+    pending->wheel = wheel;
+    pending->pan   = pan;
+    return true;
+}
+
 void process_mouse_queue_task(device_t *state) {
-    mouse_report_t report = {0};
+    queued_mouse_report_t *next;
+    mouse_report_t *report = &state->mouse_pending.report;
 
     /* We need to be connected to the host to send messages */
     if (!state->tud_connected)
         return;
 
-    /* Peek first, if there is anything there... */
-    if (!queue_try_peek(&state->mouse_queue, &report))
+    /* Pull in as many queued reports as we can merge with the pending one */
+    while ((next = ring_peek(&state->mouse_queue.ring))) {
+        if (!state->mouse_pending_valid)
+            state->mouse_pending = *next;
+        else if (!coalesce_mouse_report(report, &next->report))
+            break;
+
+        state->mouse_pending_valid = true;
+        ring_pop(&state->mouse_queue.ring);
+    }
+
+    if (!state->mouse_pending_valid) {
+        state->mouse_latency_us = 0;
         return;
+    }
+
+    state->mouse_latency_us = time_us_32() - state->mouse_pending.queued_at;
 
     /* If we are suspended, let's wake the host up */
     if (tud_suspended())
@@ -363,11 +446,15 @@ void process_mouse_queue_task(device_t *state) {
 
     /* Try sending it to the host, if it's successful */
     bool succeeded
-        = tud_mouse_report(report.mode, report.buttons, report.x, report.y, report.wheel, report.pan);
+        = tud_mouse_report(report->mode, report->buttons, report->x, report->y, report->wheel, report->pan);
 
-    /* ... then we can remove it from the queue */
-    if (succeeded)
-        queue_try_remove(&state->mouse_queue, &report);
+    /* ... then we can drop it and remember how long it waited */
+    if (succeeded) {
+        state->mouse_pending_valid = false;
+
+        if (state->mouse_latency_us > state->mouse_latency_max_us)
+            state->mouse_latency_max_us = state->mouse_latency_us;
+    }
 }
 
 void queue_mouse_report(mouse_report_t *report, device_t *state) {
@@ -375,5 +462,6 @@ void queue_mouse_report(mouse_report_t *report, device_t *state) {
     if (!state->tud_connected)
         return;
 
-    queue_try_add(&state->mouse_queue, report);
+    queued_mouse_report_t item = {.report = *report, .queued_at = time_us_32()};
+    ring_try_add(&state->mouse_queue.ring, &item);
 }
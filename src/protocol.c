@@ -10,8 +10,37 @@
  */
 #include "main.h"
 
+/* Scheduler statistics take 6 consecutive indexes for each task slot, MAX_TASKS_PER_CORE slots per
+   core, so adding a task doesn't move anything. Slots without a task read as zero. */
+#define TASK_STATS_INDEX(core, task) (100 + 6 * ((core) * MAX_TASKS_PER_CORE + (task)))
+
+#define TASK_STATS_FIELDS(core, task)                                                                                   \
+    { TASK_STATS_INDEX(core, task) + 0, true, UINT32, 4, offsetof(device_t, task_stats[core][task].run_count), true },   \
+    { TASK_STATS_INDEX(core, task) + 1, true, UINT32, 4, offsetof(device_t, task_stats[core][task].exec_min_us), true }, \
+    { TASK_STATS_INDEX(core, task) + 2, true, UINT32, 4, offsetof(device_t, task_stats[core][task].exec_max_us), true }, \
+    { TASK_STATS_INDEX(core, task) + 3, true, UINT32, 4, offsetof(device_t, task_stats[core][task].exec_avg_us), true }, \
+    { TASK_STATS_INDEX(core, task) + 4, true, UINT32, 4, offsetof(device_t, task_stats[core][task].late_max_us), true }, \
+    { TASK_STATS_INDEX(core, task) + 5, true, UINT32, 4, offsetof(device_t, task_stats[core][task].late_avg_us), true }
+
+#define CORE_TASK_STATS_FIELDS(core)                                                     \
+    TASK_STATS_FIELDS(core, 0), TASK_STATS_FIELDS(core, 1), TASK_STATS_FIELDS(core, 2), \
+    TASK_STATS_FIELDS(core, 3), TASK_STATS_FIELDS(core, 4), TASK_STATS_FIELDS(core, 5), \
+    TASK_STATS_FIELDS(core, 6), TASK_STATS_FIELDS(core, 7)
+
+_Static_assert(MAX_TASKS_PER_CORE == 8, "CORE_TASK_STATS_FIELDS lists every slot");
+_Static_assert(TASK_STATS_INDEX(NUM_CORES, 0) <= 196, "Task statistics run into the indexes after them");
+
+/* Outgoing UART lane statistics take 3 consecutive indexes for each lane */
+#define UART_LANE_FIELDS(idx, lane)                                                           \
+    { idx + 0, true, UINT32, 4, offsetof(device_t, uart_tx_lane_stats[lane].depth_max) },     \
+    { idx + 1, true, UINT32, 4, offsetof(device_t, uart_tx_lane_stats[lane].latency_us) },    \
+    { idx + 2, true, UINT32, 4, offsetof(device_t, uart_tx_lane_stats[lane].latency_max_us) }
+
+#define UART_RX_COUNT_FIELD(type) { 200 + type, true, UINT32, 4, offsetof(device_t, uart_rx_count[type]), true }
+
+/* Everything GET_ALL_VALS sends goes into hid_queue_out at once, polled fields don't count */
 const field_map_t api_field_map[] = {
-/* Index, Rdonly, Type, Len, Offset in struct */
+/* Index, Rdonly, Type, Len, Offset in struct, Polled */
     { 0,  true,  UINT8,  1, offsetof(device_t, active_output) },
     { 1,  true,  INT16,  2, offsetof(device_t, pointer_x) },
     { 2,  true,  INT16,  2, offsetof(device_t, pointer_y) },
@@ -34,6 +63,22 @@ const field_map_t api_field_map[] = {
     { 21, false, UINT64, 7, offsetof(device_t, config.output[0].screensaver.idle_time_us) },
     { 22, false, UINT64, 7, offsetof(device_t, config.output[0].screensaver.max_time_us) },
 
+    /* Acceleration curve, magnitude and Q12 factor for each point */
+    { 23, false, UINT16, 2, offsetof(device_t, config.output[0].accel_curve[0].value) },
+    { 24, false, UINT16, 2, offsetof(device_t, config.output[0].accel_curve[0].factor) },
+    { 25, false, UINT16, 2, offsetof(device_t, config.output[0].accel_curve[1].value) },
+    { 26, false, UINT16, 2, offsetof(device_t, config.output[0].accel_curve[1].factor) },
+    { 27, false, UINT16, 2, offsetof(device_t, config.output[0].accel_curve[2].value) },
+    { 28, false, UINT16, 2, offsetof(device_t, config.output[0].accel_curve[2].factor) },
+    { 29, false, UINT16, 2, offsetof(device_t, config.output[0].accel_curve[3].value) },
+    { 30, false, UINT16, 2, offsetof(device_t, config.output[0].accel_curve[3].factor) },
+    { 31, false, UINT16, 2, offsetof(device_t, config.output[0].accel_curve[4].value) },
+    { 32, false, UINT16, 2, offsetof(device_t, config.output[0].accel_curve[4].factor) },
+    { 33, false, UINT16, 2, offsetof(device_t, config.output[0].accel_curve[5].value) },
+    { 34, false, UINT16, 2, offsetof(device_t, config.output[0].accel_curve[5].factor) },
+    { 35, false, UINT16, 2, offsetof(device_t, config.output[0].accel_curve[6].value) },
+    { 36, false, UINT16, 2, offsetof(device_t, config.output[0].accel_curve[6].factor) },
+
     /* Output B */
     { 40, false, UINT32, 4, offsetof(device_t, config.output[1].number) },
     { 41, false, UINT32, 4, offsetof(device_t, config.output[1].screen_count) },
@@ -48,6 +93,20 @@ const field_map_t api_field_map[] = {
     { 50, false, UINT8,  1, offsetof(device_t, config.output[1].screensaver.only_if_inactive) },
     { 51, false, UINT64, 7, offsetof(device_t, config.output[1].screensaver.idle_time_us) },
     { 52, false, UINT64, 7, offsetof(device_t, config.output[1].screensaver.max_time_us) },
+    { 53, false, UINT16, 2, offsetof(device_t, config.output[1].accel_curve[0].value) },
+    { 54, false, UINT16, 2, offsetof(device_t, config.output[1].accel_curve[0].factor) },
+    { 55, false, UINT16, 2, offsetof(device_t, config.output[1].accel_curve[1].value) },
+    { 56, false, UINT16, 2, offsetof(device_t, config.output[1].accel_curve[1].factor) },
+    { 57, false, UINT16, 2, offsetof(device_t, config.output[1].accel_curve[2].value) },
+    { 58, false, UINT16, 2, offsetof(device_t, config.output[1].accel_curve[2].factor) },
+    { 59, false, UINT16, 2, offsetof(device_t, config.output[1].accel_curve[3].value) },
+    { 60, false, UINT16, 2, offsetof(device_t, config.output[1].accel_curve[3].factor) },
+    { 61, false, UINT16, 2, offsetof(device_t, config.output[1].accel_curve[4].value) },
+    { 62, false, UINT16, 2, offsetof(device_t, config.output[1].accel_curve[4].factor) },
+    { 63, false, UINT16, 2, offsetof(device_t, config.output[1].accel_curve[5].value) },
+    { 64, false, UINT16, 2, offsetof(device_t, config.output[1].accel_curve[5].factor) },
+    { 65, false, UINT16, 2, offsetof(device_t, config.output[1].accel_curve[6].value) },
+    { 66, false, UINT16, 2, offsetof(device_t, config.output[1].accel_curve[6].factor) },
 
     /* Common config */
     { 70, false, UINT32, 4, offsetof(device_t, config.version) },
@@ -66,6 +125,56 @@ const field_map_t api_field_map[] = {
     { 80, true,  UINT8,  1, offsetof(device_t, keyboard_connected) },
     { 81, true,  UINT8,  1, offsetof(device_t, switch_lock) },
     { 82, true,  UINT8,  1, offsetof(device_t, relative_mouse) },
+    { 83, true,  UINT32, 4, offsetof(device_t, mouse_latency_us) },
+    { 84, true,  UINT32, 4, offsetof(device_t, mouse_latency_max_us) },
+    { 85, true,  UINT32, 4, offsetof(device_t, uart_rx_packets) },
+    { 86, true,  UINT32, 4, offsetof(device_t, uart_rx_packets_max) },
+    { 87, true,  UINT32, 4, offsetof(device_t, uart_rx_level_max) },
+    { 88, true,  UINT32, 4, offsetof(device_t, uart_rx_latency_us) },
+    { 89, true,  UINT32, 4, offsetof(device_t, uart_rx_latency_max_us) },
+    { 90, true,  UINT32, 4, offsetof(device_t, uart_rx_rejected) },
+    { 91, true,  UINT32, 4, offsetof(device_t, uart_rx_crc_errors) },
+    { 92, true,  UINT32, 4, offsetof(device_t, uart_rx_checksum_errors) },
+    { 93, true,  UINT32, 4, offsetof(device_t, uart_rx_skipped_bytes) },
+    UART_LANE_FIELDS(94, UART_LANE_INPUT),
+    UART_LANE_FIELDS(97, UART_LANE_BULK),
+
+    /* Task statistics, 100 - 195 */
+    CORE_TASK_STATS_FIELDS(0),
+    CORE_TASK_STATS_FIELDS(1),
+
+    { 196, true, UINT32, 4, offsetof(device_t, uart_tx_mouse_merged) },
+    { 197, true, UINT32, 4, offsetof(device_t, uart_tx_mouse_packed) },
+
+    /* Received packet counters, index is 200 + packet type */
+    UART_RX_COUNT_FIELD(KEYBOARD_REPORT_MSG),
+    UART_RX_COUNT_FIELD(MOUSE_REPORT_MSG),
+    UART_RX_COUNT_FIELD(OUTPUT_SELECT_MSG),
+    UART_RX_COUNT_FIELD(FIRMWARE_UPGRADE_MSG),
+    UART_RX_COUNT_FIELD(MOUSE_ZOOM_MSG),
+    UART_RX_COUNT_FIELD(KBD_SET_REPORT_MSG),
+    UART_RX_COUNT_FIELD(SWITCH_LOCK_MSG),
+    UART_RX_COUNT_FIELD(SYNC_BORDERS_MSG),
+    UART_RX_COUNT_FIELD(FLASH_LED_MSG),
+    UART_RX_COUNT_FIELD(WIPE_CONFIG_MSG),
+    UART_RX_COUNT_FIELD(SCREENSAVER_MSG),
+    UART_RX_COUNT_FIELD(HEARTBEAT_MSG),
+    UART_RX_COUNT_FIELD(GAMING_MODE_MSG),
+    UART_RX_COUNT_FIELD(CONSUMER_CONTROL_MSG),
+    UART_RX_COUNT_FIELD(SAVE_CONFIG_MSG),
+    UART_RX_COUNT_FIELD(REBOOT_MSG),
+    UART_RX_COUNT_FIELD(GET_VAL_MSG),
+    UART_RX_COUNT_FIELD(SET_VAL_MSG),
+    UART_RX_COUNT_FIELD(GET_ALL_VALS_MSG),
+    UART_RX_COUNT_FIELD(PROXY_PACKET_MSG),
+    UART_RX_COUNT_FIELD(REQUEST_BYTE_MSG),
+    UART_RX_COUNT_FIELD(RESPONSE_BYTE_MSG),
+    UART_RX_COUNT_FIELD(RESPONSE_CHUNK_MSG),
+    UART_RX_COUNT_FIELD(MOUSE_TRAIL_MSG),
+    UART_RX_COUNT_FIELD(REQUEST_PAGE_MSG),
+    UART_RX_COUNT_FIELD(RESPONSE_PAGE_LZ_MSG),
+    UART_RX_COUNT_FIELD(REQUEST_MANIFEST_MSG),
+    UART_RX_COUNT_FIELD(FW_MANIFEST_MSG),
 };
 
 const field_map_t* get_field_map_entry(uint32_t index) {
@@ -96,7 +205,7 @@ void _queue_packet(uint8_t *payload, device_t *state, uint8_t type, uint8_t len,
     };
 
     memcpy(generic_packet.data, payload, len);
-    queue_try_add(&state->hid_queue_out, &generic_packet);
+    ring_try_add(&state->hid_queue_out[get_core_num()].ring, &generic_packet);
 }
 
 void queue_cfg_packet(uart_packet_t *packet, device_t *state) {
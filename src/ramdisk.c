@@ -46,8 +46,11 @@ int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void *buff
     else if (lba >= ACTUAL_NUMBER_OF_BLOCKS)
         memset(buffer, 0x00, bufsize);
 
-    else
+    else {
+        lock_flash(&global_state);
         memcpy(buffer, addr, bufsize);
+        unlock_flash(&global_state);
+    }
 
     return (int32_t)bufsize;
 }
@@ -79,16 +82,20 @@ int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t *
 
     /* Update checksum continuously as blocks are being received */
     const uint32_t last_block_with_checksum = (STAGING_IMAGE_SIZE - FLASH_SECTOR_SIZE) / FLASH_PAGE_SIZE;
-    for (int i=0; i<FLASH_PAGE_SIZE && uf2->blockNo < last_block_with_checksum; i++)
-        global_state.fw.checksum = crc32_iter(global_state.fw.checksum, buffer[32 + i]);
+    if (uf2->blockNo < last_block_with_checksum)
+        global_state.fw.checksum = crc32_update(global_state.fw.checksum, &buffer[32], FLASH_PAGE_SIZE);
 
     write_flash_page(flash_addr, &buffer[32]);
 
     if (is_final_block) {
         global_state.fw.checksum = ~global_state.fw.checksum;
 
+        lock_flash(&global_state);
+        bool image_ok = global_state.fw.checksum == calculate_firmware_crc32();
+        unlock_flash(&global_state);
+
         /* If checksums don't match, overwrite first sector and rely on ROM bootloader for recovery */
-        if (global_state.fw.checksum != calculate_firmware_crc32()) {
+        if (!image_ok) {
             flash_range_erase((uint32_t)ADDR_FW_RUNNING - XIP_BASE, FLASH_SECTOR_SIZE);
             reset_usb_boot(1 << PICO_DEFAULT_LED_PIN, 0);
         }
@@ -152,7 +152,7 @@ bool is_config_mode_active(device_t *state) {
  * ================================================== */
 const uint8_t* uart_buffer_pointers[1] = {uart_rxbuf}; /* DMA 控制通道所指向的缓冲区指针数组 */
 uint8_t uart_rxbuf[DMA_RX_BUFFER_SIZE] __attribute__((aligned(DMA_RX_BUFFER_SIZE))) ; /* DMA 接收环形缓冲区 */
-uint8_t uart_txbuf[DMA_TX_BUFFER_SIZE] __attribute__((aligned(DMA_TX_BUFFER_SIZE))) ; /* DMA 发送缓冲区 */
+uint8_t uart_txbuf[2][DMA_TX_BUFFER_SIZE] __attribute__((aligned(4))) ; /* DMA 发送缓冲区，一个发送时填充另一个 */
 
 static void configure_tx_dma(device_t *state) {
     state->dma_tx_channel = dma_claim_unused_channel(true); /* 申请一个空闲的 DMA 通道用于 TX */
@@ -173,7 +173,7 @@ static void configure_tx_dma(device_t *state) {
         state->dma_tx_channel,
         &tx_config,
         &uart0_hw->dr, /* 目标地址：UART0 数据寄存器 */
-        uart_txbuf,    /* 源地址：TX 缓冲区 */
+        uart_txbuf[0], /* 源地址：TX 缓冲区 */
         0,             /* 初始传输长度 0，稍后设置 */
         false
     );
@@ -222,6 +222,8 @@ static void configure_rx_dma(device_t *state) {
         false);
 
     dma_channel_start(state->dma_control_channel); /* 启动控制 DMA 通道，让环形缓冲区开始工作 */
+
+    state->uart_rx_needed = RAW_PACKET_LENGTH; /* 至少要有一个常规包的长度才唤醒接收任务 */
 }
 
 
@@ -254,18 +256,28 @@ void initial_setup(device_t *state) {
     serial1_init(); /* 新增：初始化 UART1（用于调试/接收 A 板数据） */
 
     /* Initialize keyboard and mouse queues */
-    queue_init(&state->kbd_queue, sizeof(hid_keyboard_report_t), KBD_QUEUE_LENGTH); /* 初始化键盘队列 */
-    queue_init(&state->mouse_queue, sizeof(mouse_report_t), MOUSE_QUEUE_LENGTH); /* 初始化鼠标队列 */
+    ring_init(&state->kbd_queue); /* 初始化键盘队列 */
+    ring_init(&state->mouse_queue); /* 初始化鼠标队列 */
 
     /* Initialize keyboard states for all devices */
     memset(state->kbd_states, 0, sizeof(state->kbd_states)); /* 清零键盘状态数组 */
     state->kbd_device_count = 0; /* 键盘设备计数器清零 */
 
     /* Initialize generic HID packet queue */
-    queue_init(&state->hid_queue_out, sizeof(hid_generic_pkt_t), HID_QUEUE_LENGTH); /* 初始化通用 HID 队列 */
+    for (int core = 0; core < NUM_CORES; core++)
+        ring_init(&state->hid_queue_out[core]); /* 初始化通用 HID 队列，每个核心一个 */
+
+    /* Initialize UART queues */
+    for (int core = 0; core < NUM_CORES; core++) {
+        for (int lane = 0; lane < NUM_UART_LANES; lane++)
+            ring_init(&state->uart_tx_queue[core][lane]); /* 初始化 UART 发送队列，每个核心每个优先级一个 */
+
+        ring_init(&state->link_tx_queue[core]); /* 初始化长帧发送队列，每个核心一个 */
+        ring_init(&state->flash_queue[core]); /* 初始化闪存写入队列，每个核心一个 */
+    }
 
-    /* Initialize UART queue */
-    queue_init(&state->uart_tx_queue, sizeof(uart_packet_t), UART_QUEUE_LENGTH); /* 初始化 UART 发送队列 */
+    /* Let pending interrupts wake core0 from __wfe() when the scheduler is idle */
+    scb_hw->scr |= M0PLUS_SCR_SEVONPEND_BITS; /* 使能 SEVONPEND，中断挂起时唤醒 WFE */
 
     /* Setup RP2040 Core 1 */
     multicore_reset_core1(); /* 重置核心1 */
@@ -1,14 +1,342 @@
-/* task_scheduler: 简单的周期任务调度器
- * - 根据任务的 next_run 与 frequency 控制实际运行时间点
+/*
+ * This file is part of DeskHop (https://github.com/hrvach/deskhop).
+ * Copyright (c) 2025 Hrvoje Cavrak
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * See the file LICENSE for the full license text.
  */
-void task_scheduler(device_t *state, task_t *task) {
-    uint64_t current_time = time_us_64(); /* 当前微秒时间 */
 
-    if (current_time < task->next_run)
-        return; /* 未到执行时间，直接返回 */
+#include "main.h"
 
-    task->next_run = current_time + task->frequency; /* 计算下次执行时间 */
-    task->exec(state); /* 调用任务函数 */
+/* Bytes the RX DMA has written to the ring that we haven't looked at yet */
+static inline uint32_t get_rx_pending(device_t *state) {
+    uint32_t current_pointer
+        = (uint32_t)DMA_RX_BUFFER_SIZE - dma_channel_hw_addr(state->dma_rx_channel)->transfer_count; /* 当前 DMA 写入位置 */
+
+    return get_ptr_delta(current_pointer, state);
+}
+
+/* A page in the window that should have been complete by now, so it has to be requested again */
+static bool page_is_skipped(fw_upgrade_state_t *fw, uint32_t page) {
+    return fw->same_sectors & (1ull << (page / FW_PAGES_PER_SECTOR));
+}
+
+static bool firmware_page_overdue(device_t *state) {
+    fw_upgrade_state_t *fw = &state->fw;
+
+    if (!fw->paged)
+        return false;
+
+    if (fw->manifest_pending)
+        return time_us_32() - fw->manifest_requested_us >= FW_MANIFEST_TIMEOUT_US;
+
+    for (uint32_t page = fw->address / FLASH_PAGE_SIZE; page < fw->next_page; page++) {
+        fw_page_slot_t *slot = &fw->window[page % FW_WINDOW_PAGES];
+
+        if (!page_is_skipped(fw, page) && slot->chunks != slot->expected && time_us_32() - slot->requested_us >= FW_PAGE_TIMEOUT_US)
+            return true;
+    }
+
+    return false;
+}
+
+/* Collect the wake sources that currently have something pending. These are only hints read
+ * without locking, each task still checks properly for itself once it runs.
+ */
+static uint32_t get_wake_events(device_t *state) {
+    uint32_t events = 0;
+
+#if !DISABLE_PIO_USB
+    if (tud_task_event_ready())
+        events |= WAKE_USB_DEVICE;
+
+    if (tuh_inited() && tuh_task_event_ready())
+        events |= WAKE_USB_HOST;
+#endif
+
+    if (ring_level(&state->kbd_queue.ring))
+        events |= WAKE_KBD_QUEUE;
+
+    if (ring_level(&state->mouse_queue.ring) || state->mouse_pending_valid)
+        events |= WAKE_MOUSE_QUEUE;
+
+    for (int core = 0; core < NUM_CORES; core++) {
+        if (ring_level(&state->hid_queue_out[core].ring))
+            events |= WAKE_HID_QUEUE;
+
+        for (int lane = 0; lane < NUM_UART_LANES; lane++)
+            if (ring_level(&state->uart_tx_queue[core][lane].ring))
+                events |= WAKE_UART_TX;
+
+        if (ring_level(&state->link_tx_queue[core].ring))
+            events |= WAKE_UART_TX;
+
+        if (ring_level(&state->flash_queue[core].ring))
+            events |= WAKE_FLASH;
+    }
+
+    if (state->flash.busy)
+        events |= WAKE_FLASH;
+
+    if (state->uart_tx_staged || state->uart_tx_mouse_valid)
+        events |= WAKE_UART_TX;
+
+    if (get_rx_pending(state) >= state->uart_rx_needed)
+        events |= WAKE_UART_RX;
+
+    /* The packet receiver answers it once the flash writer is done */
+    if (state->byte_request_deferred && !state->flash.busy)
+        events |= WAKE_UART_RX;
+
+    if (state->fw.upgrade_in_progress && (state->fw.byte_done || firmware_page_overdue(state)))
+        events |= WAKE_FW_UPGRADE;
+
+    if (state->sector_crcs.unsent)
+        events |= WAKE_FW_UPGRADE;
+
+    return events;
+}
+
+/* The falling edge of a start bit on the RX pin wakes a sleeping core, so received packets don't
+ * have to wait for the next timer deadline. It's only armed right before going to sleep, since
+ * the DMA takes care of the actual data and we don't want an interrupt for every byte.
+ * The edge is also when the packet started arriving, which is where its latency is measured from.
+ */
+static void uart_rx_wakeup_callback(uint gpio, uint32_t events) {
+    gpio_set_irq_enabled(gpio, GPIO_IRQ_EDGE_FALL, false);
+
+    global_state.uart_rx_arrival_us    = time_us_32();
+    global_state.uart_rx_arrival_valid = true;
+}
+
+void uart_rx_wakeup_init(device_t *state) {
+    gpio_set_irq_enabled_with_callback(SERIAL_RX_PIN, GPIO_IRQ_EDGE_FALL, false, &uart_rx_wakeup_callback);
+}
+
+static void wait_for_event(device_t *state, uint32_t wake_on, uint64_t next_wakeup) {
+    static uint32_t last_pending;
+
+    /* If anyone on this core is waiting for UART data, make sure the RX line can wake us */
+    bool rx_wakeup   = (wake_on & WAKE_UART_RX) != 0;
+    uint32_t pending = rx_wakeup ? get_rx_pending(state) : 0;
+
+    if (rx_wakeup) {
+        bool arriving = pending && pending != last_pending;
+        last_pending  = pending;
+
+        /* Part of a packet is already here and the rest is right behind it. Instead of waking up on
+           every start bit, sleep until the last byte should be in. If nothing came since last time,
+           the line went quiet, so go back to waiting for the edge. */
+        if (arriving) {
+            uint32_t missing  = pending < state->uart_rx_needed ? state->uart_rx_needed - pending : 1;
+            uint64_t complete = time_us_64() + UART_BYTES_TIME_US(missing);
+
+            if (complete < next_wakeup)
+                next_wakeup = complete;
+
+            rx_wakeup = false;
+        }
+    }
+
+    if (rx_wakeup) {
+        gpio_acknowledge_irq(SERIAL_RX_PIN, GPIO_IRQ_EDGE_FALL);
+        gpio_set_irq_enabled(SERIAL_RX_PIN, GPIO_IRQ_EDGE_FALL, true);
+
+        /* Bytes might have arrived before we armed it, in that case don't sleep at all */
+        if (get_rx_pending(state) != pending) {
+            gpio_set_irq_enabled(SERIAL_RX_PIN, GPIO_IRQ_EDGE_FALL, false);
+            return;
+        }
+    }
+
+    /* Queues notify with __sev(), interrupts wake us through SEVONPEND, the rest is the timer */
+    best_effort_wfe_or_timeout(from_us_since_boot(next_wakeup));
+
+    if (rx_wakeup)
+        gpio_set_irq_enabled(SERIAL_RX_PIN, GPIO_IRQ_EDGE_FALL, false);
+}
+
+/* ================================================== *
+ * ===============  Deadline Min-Heap  ============== *
+ * ================================================== */
+
+static inline void heap_swap(scheduler_t *sched, int a, int b) {
+    task_t *tmp      = sched->timers[a];
+    sched->timers[a] = sched->timers[b];
+    sched->timers[b] = tmp;
+}
+
+static void heap_sift_up(scheduler_t *sched, int idx) {
+    while (idx > 0) {
+        int parent = (idx - 1) / 2;
+
+        if (sched->timers[parent]->next_run <= sched->timers[idx]->next_run)
+            break;
+
+        heap_swap(sched, parent, idx);
+        idx = parent;
+    }
+}
+
+static void heap_sift_down(scheduler_t *sched, int idx) {
+    while (true) {
+        int smallest = idx;
+        int left     = 2 * idx + 1;
+        int right    = 2 * idx + 2;
+
+        if (left < sched->num_timers && sched->timers[left]->next_run < sched->timers[smallest]->next_run)
+            smallest = left;
+
+        if (right < sched->num_timers && sched->timers[right]->next_run < sched->timers[smallest]->next_run)
+            smallest = right;
+
+        if (smallest == idx)
+            break;
+
+        heap_swap(sched, smallest, idx);
+        idx = smallest;
+    }
+}
+
+/* Timer-only tasks go into the deadline heap, event-driven ones are checked when their event is pending */
+void scheduler_init(scheduler_t *sched, task_t *tasks, int num_tasks, task_stats_t *stats) {
+    uint64_t current_time = time_us_64();
+
+    sched->tasks      = tasks;
+    sched->num_tasks  = num_tasks;
+    sched->num_timers = 0;
+    sched->wake_on    = 0;
+
+    for (int i = 0; i < num_tasks; i++) {
+        task_t *task = &tasks[i];
+
+        task->next_run = current_time;
+        sched->wake_on |= task->wake_on;
+
+        if (i < MAX_TASKS_PER_CORE) {
+            task->stats = &stats[i];
+            task->stats->exec_min_us = UINT32_MAX;
+        }
+
+        if (task->wake_on != WAKE_TIMER || sched->num_timers >= MAX_TASKS_PER_CORE)
+            continue;
+
+        sched->timers[sched->num_timers] = task;
+        heap_sift_up(sched, sched->num_timers++);
+    }
+}
+
+/* Move the deadline forward by whole periods, so the schedule keeps its phase instead of drifting
+ * by however late we were. If we were late by more than a period, skip those and count overruns.
+ */
+static inline void advance_deadline(task_t *task, uint64_t current_time) {
+    /* Runs as often as possible, but only once per pass so it can't starve everyone else */
+    if (!task->frequency) {
+        task->next_run = current_time + 1;
+        return;
+    }
+
+    task->next_run += task->frequency;
+
+    if (task->next_run > current_time)
+        return;
+
+    uint64_t missed = (current_time - task->next_run) / task->frequency + 1;
+
+    task->overruns += missed;
+    task->next_run += missed * task->frequency;
+}
+
+/* Fold a new sample into a moving average kept in 1/16 us, weight of the new sample is 1/16 */
+static inline uint32_t update_average(int32_t *avg_q4, uint32_t sample) {
+    *avg_q4 += ((int32_t)(sample << 4) - *avg_q4) >> 4;
+    return *avg_q4 >> 4;
+}
+
+/* Run the task and record how long it took and, for periodic ones, how late it started.
+ * It's two reads of the low timer word per run, so it's cheap enough to always leave on.
+ */
+static inline void run_task(device_t *state, task_t *task, uint64_t deadline, bool periodic) {
+    task_stats_t *stats = task->stats;
+    uint32_t start      = time_us_32();
+
+    task->exec(state);
+
+    if (!stats)
+        return;
+
+    uint32_t elapsed = time_us_32() - start;
+
+    stats->run_count++;
+    stats->exec_avg_us = update_average(&stats->exec_avg_q4, elapsed);
+
+    if (elapsed < stats->exec_min_us)
+        stats->exec_min_us = elapsed;
+
+    if (elapsed > stats->exec_max_us)
+        stats->exec_max_us = elapsed;
+
+    if (!periodic)
+        return;
+
+    uint32_t late = start - (uint32_t)deadline;
+
+    stats->late_avg_us = update_average(&stats->late_avg_q4, late);
+
+    if (late > stats->late_max_us)
+        stats->late_max_us = late;
+}
+
+/* task_scheduler: 事件/定时驱动的任务调度器
+ * - 定时任务按绝对截止时间存放在最小堆中，只处理到期的堆顶
+ * - 事件任务仅在其唤醒源有事件时检查
+ * - 每次调度只读取一次时间；没有任务可运行时，核心在 __wfe() 上休眠
+ */
+void task_scheduler(device_t *state, scheduler_t *sched) {
+    uint32_t events       = get_wake_events(state) & sched->wake_on;
+    uint64_t current_time = time_us_64();
+    uint64_t next_wakeup  = UINT64_MAX;
+    bool ran_any          = false;
+
+    /* Event-driven tasks, frequency is the minimum interval between two runs */
+    for (int i = 0; events && i < sched->num_tasks; i++) {
+        task_t *task = &sched->tasks[i];
+
+        if (!(events & task->wake_on))
+            continue;
+
+        if (current_time < task->next_run) {
+            if (task->next_run < next_wakeup)
+                next_wakeup = task->next_run;
+            continue;
+        }
+
+        task->next_run = current_time + task->frequency;
+        run_task(state, task, current_time, false);
+        ran_any = true;
+    }
+
+    /* Periodic tasks, keep popping the earliest deadline until nothing else is due */
+    while (sched->num_timers && sched->timers[0]->next_run <= current_time) {
+        task_t *task      = sched->timers[0];
+        uint64_t deadline = task->next_run;
+
+        advance_deadline(task, current_time);
+        heap_sift_down(sched, 0);
+
+        run_task(state, task, deadline, true);
+        ran_any = true;
+    }
+
+    if (sched->num_timers && sched->timers[0]->next_run < next_wakeup)
+        next_wakeup = sched->timers[0]->next_run;
+
+    /* Nothing was due, sleep until something happens or the earliest timer expires */
+    if (!ran_any)
+        wait_for_event(state, sched->wake_on, next_wakeup);
 }
 
 /* ================================================== *
@@ -21,12 +349,15 @@ void kick_watchdog_task(device_t *state) {
     uint64_t core1_last_loop_pass = state->core1_last_loop_pass; /* 复制 core1 的时间戳副本 */
     uint64_t current_time         = time_us_64(); /* 当前时间 */
 
+    /* Queued flash writes finish before any reboot, a config sector erased halfway would be lost */
+    bool flash_idle = flash_writer_idle(state);
+
     /* If a reboot is requested, we'll stop updating watchdog */
-    if (state->reboot_requested)
+    if (state->reboot_requested && flash_idle)
         return; /* 已请求重启则不喂狗 */
 
     /* If core1 stops updating the timestamp, we'll stop kicking the watchog and reboot */
-    if (current_time - core1_last_loop_pass < CORE1_HANG_TIMEOUT_US)
+    if (current_time - core1_last_loop_pass < CORE1_HANG_TIMEOUT_US || !flash_idle)
         watchdog_update(); /* 如果 core1 仍在正常更新，重置看门狗计时器 */
 }
 
@@ -160,8 +491,10 @@ void heartbeat_output_task(device_t *state) {
 
 #ifdef DH_DEBUG
     /* Holding the button invokes bootsel firmware upgrade */
-    if (is_bootsel_pressed())
+    if (is_bootsel_pressed()) {
+        wait_for_flash(state);
         reset_usb_boot(1 << PICO_DEFAULT_LED_PIN, 0);
+    }
 #endif
 
     uart_packet_t packet = {
@@ -172,57 +505,300 @@ void heartbeat_output_task(device_t *state) {
         },
     };
 
-    queue_try_add(&global_state.uart_tx_queue, &packet); /* 将心跳包放入 UART 发送队列，发送给另一块板 */
+    packet.data[6] = LINK_VERSION; /* 告知对端本板支持的链路版本，旧固件此处为 0 */
+
+    queue_uart_packet(state, &packet); /* 将心跳包放入 UART 发送队列，发送给另一块板 */
 }
 
 
 /* Process other outgoing hid report messages. */
 void process_hid_queue_task(device_t *state) {
 #if !DISABLE_PIO_USB
-    hid_generic_pkt_t packet;
+    for (int core = 0; core < NUM_CORES; core++) {
+        ring_t *queue = &state->hid_queue_out[core].ring;
+        hid_generic_pkt_t *packet = ring_peek(queue);
 
-    if (!queue_try_peek(&state->hid_queue_out, &packet))
-        return; /* 队列为空 */
+        if (!packet)
+            continue; /* 该核心的队列为空 */
 
-    if (!tud_hid_n_ready(packet.instance))
-        return; /* 指定实例的 HID 不可用 */
+        if (!tud_hid_n_ready(packet->instance))
+            return; /* 指定实例的 HID 不可用 */
 
-    /* ... try sending it to the host, if it's successful */
-    bool succeeded = tud_hid_n_report(packet.instance, packet.report_id, packet.data, packet.len);
+        /* ... try sending it to the host, if it's successful */
+        if (tud_hid_n_report(packet->instance, packet->report_id, packet->data, packet->len))
+            ring_pop(queue); /* ... then we can remove it from the queue */
 
-    /* ... then we can remove it from the queue. Race conditions shouldn't happen [tm] */
-    if (succeeded)
-        queue_try_remove(&state->hid_queue_out, &packet);
+        return;
+    }
 #else
     (void)state; /* USB 禁用时，不处理 HID 上行队列 */
 #endif
 }
 
-/* Task that handles copying firmware from the other device to ours */
-void firmware_upgrade_task(device_t *state) {
-    if (!state->fw.upgrade_in_progress || !state->fw.byte_done)
-        return; /* 若没有升级在进行或当前没有新字节则返回 */
+/* Whole image is in, check it against the checksum we kept while receiving it */
+static void finish_firmware_upgrade(device_t *state) {
+    state->fw.upgrade_in_progress = 0;
+    state->fw.checksum = ~state->fw.checksum;
+    state->fw.transfer_us = time_us_32() - state->fw.started_us;
 
-    if (queue_is_full(&state->uart_tx_queue))
-        return; /* UART 发送队列满则等待 */
+    lock_flash(state);
 
-    /* End condition, when reached the process is completed. */
-    if (state->fw.address > STAGING_IMAGE_SIZE) {
-        state->fw.upgrade_in_progress = 0;
-        state->fw.checksum = ~state->fw.checksum;
-
-        /* Checksum mismatch, we wipe the stage 2 bootloader and rely on ROM recovery */
-        if(calculate_firmware_crc32() != state->fw.checksum) {
-            flash_range_erase((uint32_t)ADDR_FW_RUNNING - XIP_BASE, FLASH_SECTOR_SIZE);
-            reset_usb_boot(1 << PICO_DEFAULT_LED_PIN, 0);
+    /* Checksum mismatch, we wipe the stage 2 bootloader and rely on ROM recovery */
+    if(calculate_firmware_crc32() != state->fw.checksum) {
+        flash_range_erase((uint32_t)ADDR_FW_RUNNING - XIP_BASE, FLASH_SECTOR_SIZE);
+        reset_usb_boot(1 << PICO_DEFAULT_LED_PIN, 0);
+    }
+
+    else {
+        state->_running_fw = _firmware_metadata; /* 更新运行中的固件信息 */
+        global_state.reboot_requested = true; /* 请求重启以运行新固件 */
+    }
+
+    unlock_flash(state);
+}
+
+static void queue_sector_erase(device_t *state, uint32_t sector) {
+    fw_upgrade_state_t *fw = &state->fw;
+
+    if (fw->erased_sectors & (1ull << sector))
+        return;
+
+    queue_flash_erase(state, (uint32_t)ADDR_FW_RUNNING + sector * FLASH_SECTOR_SIZE - XIP_BASE);
+    fw->erased_sectors |= 1ull << sector;
+}
+
+/* Writes a received page, erasing its sector first if needed and the next one to be written after it */
+static void queue_firmware_page(device_t *state, uint32_t page, const uint8_t *data) {
+    uint32_t sector = page / FW_PAGES_PER_SECTOR;
+
+    queue_sector_erase(state, sector);
+    queue_flash_page(state, (uint32_t)ADDR_FW_RUNNING + page * FLASH_PAGE_SIZE - XIP_BASE, data);
+
+    while (++sector < FW_SECTORS && state->fw.same_sectors & (1ull << sector))
+        ;
+
+    if (sector < FW_SECTORS)
+        queue_sector_erase(state, sector);
+}
+
+/* Streams the image from a board that answers REQUEST_PAGE_MSG. Up to FW_WINDOW_PAGES pages are
+   requested ahead and their chunks fill the window slots in whatever order they arrive. Complete pages
+   are written out in order from the start of the window, which then moves on and requests the next
+   one. Only pages that lost a chunk are requested again.
+
+   The window is kept small: the other board queues a whole page per request, and all of the window
+   has to fit in its link TX queue at once, see handle_request_page_msg().
+
+   If the other board sends a manifest first, sectors whose CRC matches ours are skipped. Erasing
+   goes by sector, so that's also the smallest part we can leave alone.
+
+   Pages go to the background flash writer. The next sector we're going to write is erased as soon
+   as we start on the current one, so the chip is rarely idle waiting for the link. */
+static void firmware_page_task(device_t *state) {
+    fw_upgrade_state_t *fw = &state->fw;
+    uint32_t page = fw->address / FLASH_PAGE_SIZE;
+
+    fw->byte_done = false;
+
+    /* Nothing is streamed before we know which sectors differ. Our own CRCs are worked out, a sector
+       per pass, while the other board's come in. */
+    if (fw->manifest_pending) {
+        bool ours_known = update_sector_crcs(state, FW_ALL_SECTORS);
+
+        if (!ours_known)
+            fw->byte_done = true;
+
+        if (fw->manifest_received != FW_ALL_SECTORS) {
+            if (time_us_32() - fw->manifest_requested_us >= FW_MANIFEST_TIMEOUT_US && request_manifest(state))
+                fw->manifest_requested_us = time_us_32();
+            return;
+        }
+
+        if (!ours_known)
+            return;
+
+        for (uint32_t sector = 0; sector < FW_SECTORS; sector++)
+            if (fw->peer_crc[sector] == state->sector_crcs.crc[sector])
+                fw->same_sectors |= 1ull << sector;
+
+        fw->manifest_pending = false;
+    }
+
+    for (; page < STAGING_PAGES_CNT; page++) {
+        fw_page_slot_t *slot = &fw->window[page % FW_WINDOW_PAGES];
+
+        uint8_t *data = slot->data;
+
+        /* Already the same here, only the checksum needs to see it. Not while flash is being written. */
+        if (page_is_skipped(fw, page)) {
+            if (!try_lock_flash(state)) {
+                fw->byte_done = true;
+                break;
+            }
+
+            if (fw->address < STAGING_IMAGE_SIZE - FLASH_SECTOR_SIZE)
+                fw->checksum = crc32_update(fw->checksum, &ADDR_FW_RUNNING[fw->address], FLASH_PAGE_SIZE);
+
+            unlock_flash(state);
+
+            fw->address += FLASH_PAGE_SIZE;
+            fw->skipped_pages++;
+            continue;
+        }
+
+        if (page >= fw->next_page || slot->chunks != slot->expected)
+            break;
+
+        /* Room for this page and the erases around it, otherwise the page waits in its slot */
+        if (flash_queue_room(state) < 3) {
+            fw->byte_done = true;
+            break;
+        }
+
+        /* Compressed pages are rebuilt in page_buffer. One that doesn't decode is requested again. */
+        if (slot->length) {
+            data = state->page_buffer;
+
+            if (!decompress_page(slot->data, slot->length, data)) {
+                slot->chunks = 0;
+                slot->requested_us = time_us_32() - FW_PAGE_TIMEOUT_US;
+                break;
+            }
+        }
+
+        /* Provide visual feedback of the ongoing copy by toggling LED for every sector */
+        if ((fw->address & 0xfff) == 0x000)
+            toggle_led();
+
+        if (fw->address < STAGING_IMAGE_SIZE - FLASH_SECTOR_SIZE)
+            fw->checksum = crc32_update(fw->checksum, data, FLASH_PAGE_SIZE);
+
+        queue_firmware_page(state, page, data);
+        fw->address += FLASH_PAGE_SIZE;
+    }
+
+    /* The last pages might still be on their way to flash */
+    if (fw->address >= STAGING_IMAGE_SIZE) {
+        if (!flash_writer_idle(state)) {
+            fw->byte_done = true;
+            return;
+        }
+
+        finish_firmware_upgrade(state);
+        return;
+    }
+
+    if (fw->next_page < page)
+        fw->next_page = page;
+
+    /* Keep the window full, if the queue is full we're back on the next pass */
+    for (; fw->next_page < STAGING_PAGES_CNT && fw->next_page < page + FW_WINDOW_PAGES; fw->next_page++) {
+        fw_page_slot_t *slot = &fw->window[fw->next_page % FW_WINDOW_PAGES];
+
+        if (page_is_skipped(fw, fw->next_page))
+            continue;
+
+        if (!request_page(state, fw->next_page)) {
+            fw->byte_done = true;
+            return;
         }
 
-        else {
-            state->_running_fw = _firmware_metadata; /* 更新运行中的固件信息 */
-            global_state.reboot_requested = true; /* 请求重启以运行新固件 */
+        slot->page         = fw->next_page;
+        slot->chunks       = 0;
+        slot->expected     = FW_PAGE_COMPLETE;
+        slot->length       = 0;
+        slot->requested_us = time_us_32();
+    }
+
+    /* Pages are answered in order, so one still missing chunks when a page requested after it is complete
+       has lost some, no need to wait. Otherwise it gets FW_PAGE_TIMEOUT_US, the request could be lost too. */
+    bool any_complete = false;
+    uint32_t newest_complete = 0;
+
+    for (uint32_t i = page; i < fw->next_page; i++) {
+        fw_page_slot_t *slot = &fw->window[i % FW_WINDOW_PAGES];
+
+        if (page_is_skipped(fw, i))
+            continue;
+
+        if (slot->chunks == slot->expected && (!any_complete || (int32_t)(slot->requested_us - newest_complete) > 0)) {
+            newest_complete = slot->requested_us;
+            any_complete    = true;
         }
     }
 
+    for (; page < fw->next_page; page++) {
+        fw_page_slot_t *slot = &fw->window[page % FW_WINDOW_PAGES];
+        bool lost = any_complete && (int32_t)(newest_complete - slot->requested_us) > 0;
+
+        if (page_is_skipped(fw, page) || slot->chunks == slot->expected || (!lost && time_us_32() - slot->requested_us < FW_PAGE_TIMEOUT_US))
+            continue;
+
+        if (!request_page(state, page))
+            break;
+
+        slot->requested_us = time_us_32();
+        fw->retransmits++;
+    }
+}
+
+/* Answers REQUEST_MANIFEST_MSG. Each FW_MANIFEST_MSG goes out as soon as the CRCs of its sectors are
+   known, at most one of them is worked out per pass. */
+static void send_manifest(device_t *state) {
+    sector_crcs_t *crcs = &state->sector_crcs;
+
+    /* The other board went away, it asks again if it comes back */
+    if (!peer_supports_long_frames(state)) {
+        crcs->unsent = 0;
+        return;
+    }
+
+    while (crcs->unsent) {
+        fw_manifest_t manifest = {.first = __builtin_ctzll(crcs->unsent), .count = FW_MANIFEST_ENTRIES};
+
+        if (manifest.first + manifest.count > FW_SECTORS)
+            manifest.count = FW_SECTORS - manifest.first;
+
+        uint64_t part = ((1ull << manifest.count) - 1) << manifest.first;
+
+        if (part & ~crcs->valid) {
+            update_sector_crcs(state, part);
+            return;
+        }
+
+        memcpy(manifest.crc, &crcs->crc[manifest.first], manifest.count * sizeof(uint32_t));
+
+        /* Queue is full, it's the next pass */
+        if (!queue_link_packet((uint8_t *)&manifest, FW_MANIFEST_MSG, 2 + manifest.count * sizeof(uint32_t)))
+            return;
+
+        crcs->unsent &= ~part;
+    }
+}
+
+/* Task that handles copying firmware from the other device to ours */
+void firmware_upgrade_task(device_t *state) {
+    if (state->sector_crcs.unsent)
+        send_manifest(state);
+
+    if (!state->fw.upgrade_in_progress)
+        return; /* 若没有升级在进行则返回 */
+
+    if (state->fw.paged) {
+        firmware_page_task(state);
+        return;
+    }
+
+    if (!state->fw.byte_done)
+        return; /* 当前没有新字节则返回 */
+
+    if (ring_is_full(get_uart_tx_queue(state, REQUEST_BYTE_MSG)))
+        return; /* UART 发送队列满则等待 */
+
+    /* End condition, when reached the process is completed. */
+    if (state->fw.address > STAGING_IMAGE_SIZE)
+        finish_firmware_upgrade(state);
+
     /* If we're on the last element of the current page, page is done - write it. */
     if (TU_U32_BYTE0(state->fw.address) == 0x00) {
 
@@ -234,22 +810,65 @@ void firmware_upgrade_task(device_t *state) {
 }
 
 void packet_receiver_task(device_t *state) {
-    uint32_t current_pointer
-        = (uint32_t)DMA_RX_BUFFER_SIZE - dma_channel_hw_addr(state->dma_rx_channel)->transfer_count; /* 当前 DMA 写入位置 */
-    uint32_t delta = get_ptr_delta(current_pointer, state); /* 计算缓冲区中尚未读取的数据长度 */
-
-    /* If we don't have enough characters for a packet, skip loop and return immediately */
-    while (delta >= RAW_PACKET_LENGTH) {
-        if (is_start_of_packet(state)) {
-            fetch_packet(state); /* 从缓冲区拉取整包 */
-            process_packet(&state->in_packet, state); /* 处理收到的包 */
-            return; /* 处理完一包后返回，让任务稍后再被调度 */
+    uint32_t delta = get_rx_pending(state); /* 计算缓冲区中尚未读取的数据长度 */
+    uint32_t packets = 0, first_handled_us = 0;
+
+    answer_deferred_byte_request(state); /* 闪存写入期间推迟的字节请求 */
+
+    if (delta > state->uart_rx_level_max)
+        state->uart_rx_level_max = delta;
+
+    /* Drain everything that's complete, but leave the other tasks some time during long bursts.
+       Anything left over keeps WAKE_UART_RX raised, so we're back on the next pass. */
+    state->uart_rx_needed = RAW_PACKET_LENGTH;
+
+    while (delta >= RAW_PACKET_LENGTH && packets < UART_RX_BUDGET) {
+        uint32_t length = get_frame_length(state);
+
+        /* Long frame that's still arriving, the wake event waits for the rest of it */
+        if (length > delta) {
+            state->uart_rx_needed = length;
+            break;
+        }
+
+        if (length) {
+            uint32_t start = state->dma_ptr;
+            uart_packet_t *packet = fetch_packet(state, length); /* 就地解析整包，校验失败时为 NULL */
+
+            if (packet)
+                dispatch_packet(packet, state); /* 处理收到的包 */
+
+            /* Latency goes up to here, not to the end of the batch */
+            if (!packets)
+                first_handled_us = time_us_32();
+
+            delta -= (state->dma_ptr - start) & (DMA_RX_BUFFER_SIZE - 1);
+            packets++;
+            continue;
         }
 
         /* No packet found, advance to next position and decrement delta */
         state->dma_ptr = NEXT_RING_IDX(state->dma_ptr); /* 环形缓冲区指针前进 */
+        state->uart_rx_skipped_bytes++;
         delta--;
     }
+
+    if (!packets)
+        return;
+
+    /* Woken up by this burst, measure from its first start bit to the first packet handled */
+    if (state->uart_rx_arrival_valid) {
+        state->uart_rx_arrival_valid = false;
+        state->uart_rx_latency_us    = first_handled_us - state->uart_rx_arrival_us;
+
+        if (state->uart_rx_latency_us > state->uart_rx_latency_max_us)
+            state->uart_rx_latency_max_us = state->uart_rx_latency_us;
+    }
+
+    state->uart_rx_packets = packets;
+
+    if (packets > state->uart_rx_packets_max)
+        state->uart_rx_packets_max = packets;
 }
 
 /* End of annotated main.c + task.c */
@@ -27,12 +27,86 @@ void write_raw_packet(uint8_t *dst, uart_packet_t *packet) {
     memcpy(dst, &pkt, RAW_PACKET_LENGTH);
 }
 
+/* Long frame with len bytes of data, the CRC also covers the length and type. Returns the frame length. */
+static int write_raw_long_frame(uint8_t *dst, uint8_t type, const uint8_t *data, uint8_t len) {
+    dst[0] = START1;
+    dst[1] = START2_LONG;
+    dst[2] = len;
+    dst[3] = type;
+
+    memcpy(&dst[LINK_HEADER_LENGTH], data, len);
+
+    uint16_t crc = calc_crc16(&dst[START_LENGTH], LINK_HEADER_LENGTH - START_LENGTH + len);
+    dst[LINK_HEADER_LENGTH + len]     = crc >> 8;
+    dst[LINK_HEADER_LENGTH + len + 1] = crc & 0xff;
+
+    return LINK_FRAME_LENGTH(len);
+}
+
+int write_raw_link_packet(uint8_t *dst, queued_link_packet_t *item) {
+    return write_raw_long_frame(dst, item->packet.type, item->packet.data, item->len);
+}
+
+/* Which lane each packet type goes out in, anything not listed is input */
+static const uint8_t uart_tx_lane[PACKET_TYPE_COUNT] = {
+    [FIRMWARE_UPGRADE_MSG] = UART_LANE_BULK,
+    [WIPE_CONFIG_MSG]      = UART_LANE_BULK,
+    [HEARTBEAT_MSG]        = UART_LANE_BULK,
+    [SAVE_CONFIG_MSG]      = UART_LANE_BULK,
+    [REBOOT_MSG]           = UART_LANE_BULK,
+    [GET_VAL_MSG]          = UART_LANE_BULK,
+    [SET_VAL_MSG]          = UART_LANE_BULK,
+    [GET_ALL_VALS_MSG]     = UART_LANE_BULK,
+    [PROXY_PACKET_MSG]     = UART_LANE_BULK,
+    [REQUEST_BYTE_MSG]     = UART_LANE_BULK,
+    [RESPONSE_BYTE_MSG]    = UART_LANE_BULK,
+    [RESPONSE_CHUNK_MSG]   = UART_LANE_BULK,
+    [REQUEST_PAGE_MSG]     = UART_LANE_BULK,
+    [RESPONSE_PAGE_LZ_MSG] = UART_LANE_BULK,
+    [REQUEST_MANIFEST_MSG] = UART_LANE_BULK,
+    [FW_MANIFEST_MSG]      = UART_LANE_BULK,
+};
+
+/* Each core gets its own outgoing rings so both can queue packets without locking */
+ring_t *get_uart_tx_queue(device_t *state, enum packet_type_e packet_type) {
+    uint8_t lane = packet_type < PACKET_TYPE_COUNT ? uart_tx_lane[packet_type] : UART_LANE_BULK;
+    return &state->uart_tx_queue[get_core_num()][lane].ring;
+}
+
+/* Queue an already built packet in the lane of its type */
+bool queue_uart_packet(device_t *state, uart_packet_t *packet) {
+    queued_uart_packet_t item = {.packet = *packet, .queued_at = time_us_32()};
+    return ring_try_add(get_uart_tx_queue(state, packet->type), &item);
+}
+
 /* Schedule packet for sending to the other box */
 void queue_packet(const uint8_t *data, enum packet_type_e packet_type, int length) {
     uart_packet_t packet = {.type = packet_type};
     memcpy(packet.data, data, length);
 
-    queue_try_add(&global_state.uart_tx_queue, &packet);
+    queue_uart_packet(&global_state, &packet);
+}
+
+/* Long frames are only sent if the other board told us recently it understands them */
+bool peer_supports_long_frames(device_t *state) {
+    return state->peer_link_version >= LINK_VERSION_LONG
+           && time_us_64() - state->peer_heartbeat_us < LINK_PEER_TIMEOUT_US;
+}
+
+/* Schedule a packet with up to LINK_MAX_PAYLOAD bytes of data for sending in a long frame. Returns
+   false if the other board can't receive it or the queue is full, the caller falls back to regular packets.
+   These are all bulk traffic. */
+bool queue_link_packet(const uint8_t *data, enum packet_type_e packet_type, int length) {
+    queued_link_packet_t item = {.len = PACKET_DATA_LENGTH, .packet.type = packet_type, .queued_at = time_us_32()};
+
+    if (length > LINK_MAX_PAYLOAD || !peer_supports_long_frames(&global_state))
+        return false;
+
+    if (length > PACKET_DATA_LENGTH)
+        item.len = length;
+
+    memcpy(item.packet.data, data, length);
+    return ring_try_add(&global_state.link_tx_queue[get_core_num()].ring, &item);
 }
 
 /* Sends just one byte of a certain packet type to the other box. */
@@ -40,65 +114,280 @@ void send_value(const uint8_t value, enum packet_type_e packet_type) {
     queue_packet(&value, packet_type, sizeof(uint8_t));
 }
 
-/* Process outgoing config report messages. */
+/* Remember the age of the oldest packet of each lane that's going out in the next transfer */
+static void track_staged(device_t *state, int lane, uint32_t queued_at) {
+    if (!(state->uart_tx_lanes_staged & (1 << lane)) || (int32_t)(queued_at - state->uart_tx_oldest[lane]) < 0)
+        state->uart_tx_oldest[lane] = queued_at;
+
+    state->uart_tx_lanes_staged |= 1 << lane;
+}
+
+static void stage_packet(device_t *state, int lane, queued_uart_packet_t *item, bool long_frames) {
+    uint8_t *buffer = &uart_txbuf[state->uart_tx_fill][state->uart_tx_staged];
+
+    /* A board that reads long frames gets everything in them, for the stronger CRC */
+    if (long_frames) {
+        state->uart_tx_staged += write_raw_long_frame(buffer, item->packet.type, item->packet.data, PACKET_DATA_LENGTH);
+    } else {
+        write_raw_packet(buffer, &item->packet);
+        state->uart_tx_staged += RAW_PACKET_LENGTH;
+    }
+
+    track_staged(state, lane, item->queued_at);
+}
+
+/* Adds the position in next to the held mouse packet as a delta from the last one, if it fits */
+static bool extend_mouse_trail(device_t *state, const mouse_report_t *next) {
+    mouse_report_t *held = (mouse_report_t *)state->uart_tx_mouse.packet.data;
+    int32_t dx = next->x, dy = next->y;
+    int32_t wheel = held->wheel + next->wheel, pan = held->pan + next->pan;
+
+    if (next->mode != held->mode || next->buttons != held->buttons || state->uart_tx_mouse_count >= MOUSE_TRAIL_MAX)
+        return false;
+
+    if (next->mode == ABSOLUTE) {
+        dx -= state->uart_tx_mouse_x;
+        dy -= state->uart_tx_mouse_y;
+    }
+
+    if (dx < INT8_MIN || dx > INT8_MAX || dy < INT8_MIN || dy > INT8_MAX
+        || wheel < INT8_MIN || wheel > INT8_MAX || pan < INT8_MIN || pan > INT8_MAX)
+        return false;
+
+    state->uart_tx_mouse_trail[state->uart_tx_mouse_count][0] = dx;
+    state->uart_tx_mouse_trail[state->uart_tx_mouse_count][1] = dy;
+    state->uart_tx_mouse_count++;
+
+    state->uart_tx_mouse_x = next->x;
+    state->uart_tx_mouse_y = next->y;
+    held->wheel = wheel;
+    held->pan   = pan;
+    return true;
+}
+
+/* Mouse packets are held back in uart_tx_mouse until a transfer can start. If the other board
+   understands MOUSE_TRAIL_MSG, the ones that follow are added to it as small deltas, so every position
+   still gets there. Otherwise, or when a delta doesn't fit, they are merged into it as long as
+   nothing has been added yet: the other board then only gets the latest position, button changes
+   are kept and wheel movement adds up. Whatever can't be added or merged pushes the held packet out
+   first, so the order of input packets doesn't change. */
+static bool hold_mouse_packet(device_t *state, queued_uart_packet_t *item, bool long_frames) {
+    mouse_report_t *held = (mouse_report_t *)state->uart_tx_mouse.packet.data;
+    mouse_report_t *next = (mouse_report_t *)item->packet.data;
+
+    if (item->packet.type != MOUSE_REPORT_MSG)
+        return false;
+
+    if (!state->uart_tx_mouse_valid) {
+        state->uart_tx_mouse       = *item;
+        state->uart_tx_mouse_valid = true;
+        state->uart_tx_mouse_count = 0;
+        state->uart_tx_mouse_x     = next->x;
+        state->uart_tx_mouse_y     = next->y;
+        return true;
+    }
+
+    if (long_frames && state->peer_link_version >= LINK_VERSION_MOUSE_TRAIL && extend_mouse_trail(state, next)) {
+        state->uart_tx_mouse_packed++;
+        return true;
+    }
+
+    if (state->uart_tx_mouse_count || !coalesce_mouse_report(held, next))
+        return false;
+
+    state->uart_tx_mouse_x = next->x;
+    state->uart_tx_mouse_y = next->y;
+    state->uart_tx_mouse_merged++;
+    return true;
+}
+
+/* Stages the held mouse packet, on its own or as a trail. Returns false if there's no room for it. */
+static bool stage_held_mouse(device_t *state, uint32_t limit, bool long_frames) {
+    uint8_t count = state->uart_tx_mouse_count;
+    uint32_t length = LINK_FRAME_LENGTH(MOUSE_REPORT_LENGTH + 1 + 2 * count);
+
+    if (!count) {
+        length = long_frames ? LINK_FRAME_LENGTH(PACKET_DATA_LENGTH) : RAW_PACKET_LENGTH;
+
+        if (state->uart_tx_staged + length > limit)
+            return false;
+
+        stage_packet(state, UART_LANE_INPUT, &state->uart_tx_mouse, long_frames);
+        state->uart_tx_mouse_valid = false;
+        return true;
+    }
+
+    if (state->uart_tx_staged + length > limit)
+        return false;
+
+    mouse_trail_t trail = {.count = count};
+
+    memcpy(&trail.report, state->uart_tx_mouse.packet.data, MOUSE_REPORT_LENGTH);
+    memcpy(trail.delta, state->uart_tx_mouse_trail, 2 * count);
+
+    state->uart_tx_staged += write_raw_long_frame(&uart_txbuf[state->uart_tx_fill][state->uart_tx_staged],
+                                                  MOUSE_TRAIL_MSG, (uint8_t *)&trail, MOUSE_REPORT_LENGTH + 1 + 2 * count);
+
+    track_staged(state, UART_LANE_INPUT, state->uart_tx_mouse.queued_at);
+    state->uart_tx_mouse_valid = false;
+    return true;
+}
+
+/* Moves queued packets of one lane from both cores into the fill buffer, until limit bytes are staged */
+static void stage_lane(device_t *state, int lane, uint32_t limit, bool long_frames) {
+    uint32_t frame_length = long_frames ? LINK_FRAME_LENGTH(PACKET_DATA_LENGTH) : RAW_PACKET_LENGTH;
+    uint32_t depth = 0;
+
+    for (int core = 0; core < NUM_CORES; core++) {
+        ring_t *queue = &state->uart_tx_queue[core][lane].ring;
+        queued_uart_packet_t *item;
+
+        depth += ring_level(queue);
+
+        while ((item = ring_peek(queue))) {
+            if (lane == UART_LANE_INPUT && hold_mouse_packet(state, item, long_frames)) {
+                ring_pop(queue);
+                continue;
+            }
+
+            /* The held mouse packet goes first, the one we peeked is looked at again */
+            if (lane == UART_LANE_INPUT && state->uart_tx_mouse_valid) {
+                if (!stage_held_mouse(state, limit, long_frames))
+                    break;
+
+                continue;
+            }
+
+            if (state->uart_tx_staged + frame_length > limit)
+                break;
+
+            stage_packet(state, lane, item, long_frames);
+            ring_pop(queue);
+        }
+    }
+
+    if (depth > state->uart_tx_lane_stats[lane].depth_max)
+        state->uart_tx_lane_stats[lane].depth_max = depth;
+}
+
+/* Process outgoing packets. They are encoded back-to-back into one buffer while the DMA sends
+   the other, then the whole batch goes out in a single transfer. This keeps the line busy instead
+   of leaving a gap after every packet until the task gets to run again.
+
+   Input is staged whenever there's room. Bulk packets and long frames are only added right before a
+   transfer starts, at most UART_TX_BULK_BUDGET bytes of them, so a keypress is never stuck behind a
+   whole buffer of firmware or config traffic, neither in the queue nor on the wire. The held mouse
+   packet also waits for that moment, see hold_mouse_packet(). */
 void process_uart_tx_task(device_t *state) {
-    uart_packet_t packet = {0};
+    uint8_t *buffer = uart_txbuf[state->uart_tx_fill];
+    bool long_frames = peer_supports_long_frames(state);
+
+    stage_lane(state, UART_LANE_INPUT, DMA_TX_BUFFER_SIZE, long_frames);
 
     if (dma_channel_is_busy(state->dma_tx_channel))
         return;
 
-    if (!queue_try_remove(&state->uart_tx_queue, &packet))
+    if (state->uart_tx_mouse_valid)
+        stage_held_mouse(state, DMA_TX_BUFFER_SIZE, long_frames);
+
+    uint32_t bulk_limit = state->uart_tx_staged + UART_TX_BULK_BUDGET;
+
+    if (bulk_limit > DMA_TX_BUFFER_SIZE)
+        bulk_limit = DMA_TX_BUFFER_SIZE;
+
+    stage_lane(state, UART_LANE_BULK, bulk_limit, long_frames);
+
+    for (int core = 0; core < NUM_CORES; core++) {
+        ring_t *queue = &state->link_tx_queue[core].ring;
+        queued_link_packet_t *item;
+
+        while ((item = ring_peek(queue)) && state->uart_tx_staged + LINK_FRAME_LENGTH(item->len) <= bulk_limit) {
+            state->uart_tx_staged += write_raw_link_packet(&buffer[state->uart_tx_staged], item);
+            track_staged(state, UART_LANE_BULK, item->queued_at);
+            ring_pop(queue);
+        }
+    }
+
+    if (!state->uart_tx_staged)
         return;
 
-    write_raw_packet(uart_txbuf, &packet);
-    dma_channel_transfer_from_buffer_now(state->dma_tx_channel, uart_txbuf, RAW_PACKET_LENGTH);
+    dma_channel_transfer_from_buffer_now(state->dma_tx_channel, buffer, state->uart_tx_staged);
+
+    for (int lane = 0; lane < NUM_UART_LANES; lane++) {
+        uart_lane_stats_t *stats = &state->uart_tx_lane_stats[lane];
+
+        if (!(state->uart_tx_lanes_staged & (1 << lane)))
+            continue;
+
+        stats->latency_us = time_us_32() - state->uart_tx_oldest[lane];
+
+        if (stats->latency_us > stats->latency_max_us)
+            stats->latency_max_us = stats->latency_us;
+    }
+
+    state->uart_tx_fill ^= 1;
+    state->uart_tx_staged = 0;
+    state->uart_tx_lanes_staged = 0;
 }
 
 /* ================================================== *
  * ===============  Parsing Packets  ================ *
  * ================================================== */
 
-const uart_handler_t uart_handler[] = {
+/* Indexed by packet type, types without a handler are NULL */
+const action_handler_t uart_handler[PACKET_TYPE_COUNT] = {
     /* Core functions */
-    {.type = KEYBOARD_REPORT_MSG, .handler = handle_keyboard_uart_msg},
-    {.type = MOUSE_REPORT_MSG, .handler = handle_mouse_abs_uart_msg},
-    {.type = OUTPUT_SELECT_MSG, .handler = handle_output_select_msg},
+    [KEYBOARD_REPORT_MSG]  = handle_keyboard_uart_msg,
+    [MOUSE_REPORT_MSG]     = handle_mouse_abs_uart_msg,
+    [MOUSE_TRAIL_MSG]      = handle_mouse_trail_msg,
+    [OUTPUT_SELECT_MSG]    = handle_output_select_msg,
 
     /* Box control */
-    {.type = MOUSE_ZOOM_MSG, .handler = handle_mouse_zoom_msg},
-    {.type = KBD_SET_REPORT_MSG, .handler = handle_set_report_msg},
-    {.type = SWITCH_LOCK_MSG, .handler = handle_switch_lock_msg},
-    {.type = SYNC_BORDERS_MSG, .handler = handle_sync_borders_msg},
-    {.type = FLASH_LED_MSG, .handler = handle_flash_led_msg},
-    {.type = GAMING_MODE_MSG, .handler = handle_toggle_gaming_msg},
-    {.type = CONSUMER_CONTROL_MSG, .handler = handle_consumer_control_msg},
-    {.type = SCREENSAVER_MSG, .handler = handle_screensaver_msg},
+    [MOUSE_ZOOM_MSG]       = handle_mouse_zoom_msg,
+    [KBD_SET_REPORT_MSG]   = handle_set_report_msg,
+    [SWITCH_LOCK_MSG]      = handle_switch_lock_msg,
+    [SYNC_BORDERS_MSG]     = handle_sync_borders_msg,
+    [FLASH_LED_MSG]        = handle_flash_led_msg,
+    [GAMING_MODE_MSG]      = handle_toggle_gaming_msg,
+    [CONSUMER_CONTROL_MSG] = handle_consumer_control_msg,
+    [SCREENSAVER_MSG]      = handle_screensaver_msg,
 
     /* Config */
-    {.type = WIPE_CONFIG_MSG, .handler = handle_wipe_config_msg},
-    {.type = SAVE_CONFIG_MSG, .handler = handle_save_config_msg},
-    {.type = REBOOT_MSG, .handler = handle_reboot_msg},
-    {.type = GET_VAL_MSG, .handler = handle_api_msgs},
-    {.type = GET_ALL_VALS_MSG, .handler = handle_api_read_all_msg},
-    {.type = SET_VAL_MSG, .handler = handle_api_msgs},
+    [WIPE_CONFIG_MSG]      = handle_wipe_config_msg,
+    [SAVE_CONFIG_MSG]      = handle_save_config_msg,
+    [REBOOT_MSG]           = handle_reboot_msg,
+    [GET_VAL_MSG]          = handle_api_msgs,
+    [GET_ALL_VALS_MSG]     = handle_api_read_all_msg,
+    [SET_VAL_MSG]          = handle_api_msgs,
 
     /* Firmware */
-    {.type = REQUEST_BYTE_MSG, .handler = handle_request_byte_msg},
-    {.type = RESPONSE_BYTE_MSG, .handler = handle_response_byte_msg},
-    {.type = FIRMWARE_UPGRADE_MSG, .handler = handle_fw_upgrade_msg},
+    [REQUEST_BYTE_MSG]     = handle_request_byte_msg,
+    [RESPONSE_BYTE_MSG]    = handle_response_byte_msg,
+    [RESPONSE_CHUNK_MSG]   = handle_response_chunk_msg,
+    [REQUEST_PAGE_MSG]     = handle_request_page_msg,
+    [RESPONSE_PAGE_LZ_MSG] = handle_response_page_lz_msg,
+    [REQUEST_MANIFEST_MSG] = handle_request_manifest_msg,
+    [FW_MANIFEST_MSG]      = handle_fw_manifest_msg,
+    [FIRMWARE_UPGRADE_MSG] = handle_fw_upgrade_msg,
 
-    {.type = HEARTBEAT_MSG, .handler = handle_heartbeat_msg},
-    {.type = PROXY_PACKET_MSG, .handler = handle_proxy_msg},
+    [HEARTBEAT_MSG]        = handle_heartbeat_msg,
+    [PROXY_PACKET_MSG]     = handle_proxy_msg,
 };
 
+/* Hands an already verified packet to its handler */
+void dispatch_packet(uart_packet_t *packet, device_t *state) {
+    if (packet->type >= PACKET_TYPE_COUNT || !uart_handler[packet->type]) {
+        state->uart_rx_rejected++;
+        return;
+    }
+
+    state->uart_rx_count[packet->type]++;
+    uart_handler[packet->type](packet, state);
+}
+
 void process_packet(uart_packet_t *packet, device_t *state) {
     if (!verify_checksum(packet))
         return;
 
-    for (int i = 0; i < ARRAY_SIZE(uart_handler); i++) {
-        if (uart_handler[i].type == packet->type) {
-            uart_handler[i].handler(packet, state);
-            return;
-        }
-    }
+    dispatch_packet(packet, state);
 }
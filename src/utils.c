@@ -11,6 +11,10 @@
 
 #include "main.h"
 
+#if PICO_ON_DEVICE
+#include <pico/mutex.h>
+#endif
+
 /* ================================================== *
  * ==============  Checksum Functions  ============== *
  * ================================================== */
@@ -34,41 +38,276 @@ uint32_t crc32_iter(uint32_t crc, const uint8_t byte) {
     return crc32_lookup_table[(byte ^ crc) & 0xff] ^ (crc >> 8);
 }
 
-/* TODO - use DMA sniffer's built-in CRC32 */
-uint32_t calc_crc32(const uint8_t *s, size_t n) {
-    uint32_t crc = 0xffffffff;
+/* Table driven CRC-16/CCITT, used on the link between boards. Run over data followed by its own CRC
+   (MSB first), it comes out as 0. */
+uint16_t calc_crc16(const uint8_t *data, int length) {
+    uint16_t crc = LINK_CRC_INIT;
+
+    for (int i = 0; i < length; i++)
+        crc = (crc << 8) ^ crc16_lookup_table[(crc >> 8) ^ data[i]];
+
+    return crc;
+}
+
+#if PICO_ON_DEVICE
+auto_init_mutex(crc32_sniffer_mutex);
+
+static uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+    x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+    x = ((x >> 4) & 0x0f0f0f0f) | ((x & 0x0f0f0f0f) << 4);
+    return __builtin_bswap32(x);
+}
+
+/* The DMA sniffer computes the CRC while a channel reads the data into a dummy word. It takes the
+   bytes bit reversed and keeps its register that way too, reading it back reverses it again. There
+   is only one sniffer, if the other core has it we return false and the CRC is done in software. */
+static bool crc32_sniffer(uint32_t *crc, const uint8_t *data, size_t length) {
+    static int channel = -1;
+    static uint32_t sink;
+
+    if (!mutex_try_enter(&crc32_sniffer_mutex, NULL))
+        return false;
+
+    if (channel < 0)
+        channel = dma_claim_unused_channel(false);
+
+    if (channel >= 0) {
+        dma_channel_config config = dma_channel_get_default_config(channel);
+        channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+        channel_config_set_read_increment(&config, true);
+        channel_config_set_write_increment(&config, false);
+        channel_config_set_sniff_enable(&config, true);
+
+        dma_sniffer_enable(channel, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+        dma_sniffer_set_output_reverse_enabled(true);
+        dma_hw->sniff_data = reverse_bits(*crc);
 
-    for(size_t i=0; i < n; i++) {
-        crc = crc32_iter(crc, s[i]);
+        dma_channel_configure(channel, &config, &sink, data, length, true);
+        dma_channel_wait_for_finish_blocking(channel);
+
+        *crc = dma_hw->sniff_data;
+        dma_sniffer_disable();
     }
 
-    return ~crc;
+    mutex_exit(&crc32_sniffer_mutex);
+    return channel >= 0;
+}
+#else
+/* No sniffer on the host. Slice-by-8 instead: table k gives the CRC of a byte followed by k zero
+   bytes, so 8 bytes take 8 independent lookups instead of 8 dependent ones. */
+static uint32_t crc32_slices[8][256];
+
+static void crc32_slice_by_8(uint32_t *crc, const uint8_t **data, size_t *length) {
+    if (!crc32_slices[0][1])
+        for (int i = 0; i < 256; i++)
+            for (int k = 0; k < 8; k++)
+                crc32_slices[k][i] = k ? crc32_iter(crc32_slices[k - 1][i], 0) : crc32_lookup_table[i];
+
+    for (; *length >= 8; *length -= 8, *data += 8) {
+        const uint8_t *p = *data;
+        uint32_t low  = *crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t high = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+
+        *crc = crc32_slices[7][low & 0xff] ^ crc32_slices[6][(low >> 8) & 0xff]
+             ^ crc32_slices[5][(low >> 16) & 0xff] ^ crc32_slices[4][low >> 24]
+             ^ crc32_slices[3][high & 0xff] ^ crc32_slices[2][(high >> 8) & 0xff]
+             ^ crc32_slices[1][(high >> 16) & 0xff] ^ crc32_slices[0][high >> 24];
+    }
+}
+#endif
+
+/* Carries a running CRC32 over more data, crc is the value before the final inversion. Short runs
+   aren't worth setting up a DMA transfer for. */
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length) {
+#if PICO_ON_DEVICE
+    if (length >= CRC32_SNIFFER_MIN_LENGTH && crc32_sniffer(&crc, data, length))
+        return crc;
+#else
+    crc32_slice_by_8(&crc, &data, &length);
+#endif
+
+    for (size_t i = 0; i < length; i++)
+        crc = crc32_iter(crc, data[i]);
+
+    return crc;
+}
+
+uint32_t calc_crc32(const uint8_t *s, size_t n) {
+    return ~crc32_update(0xffffffff, s, n);
+}
+
+/* Works out the next sector CRC of wanted that isn't known yet, one per call so reading the image
+   doesn't hold up the core for long. Returns true once all of wanted are known. */
+bool update_sector_crcs(device_t *state, uint64_t wanted) {
+    sector_crcs_t *crcs = &state->sector_crcs;
+    uint64_t missing = wanted & ~crcs->valid;
+
+    if (!missing)
+        return true;
+
+    /* While our flash is being written, it's the next pass */
+    if (!try_lock_flash(state))
+        return false;
+
+    uint32_t sector = __builtin_ctzll(missing);
+
+    crcs->crc[sector] = calc_crc32(&ADDR_FW_RUNNING[sector * FLASH_SECTOR_SIZE], FLASH_SECTOR_SIZE);
+    crcs->valid |= 1ull << sector;
+
+    unlock_flash(state);
+    return missing == 1ull << sector;
 }
 
 uint32_t calculate_firmware_crc32(void) {
     return calc_crc32(ADDR_FW_RUNNING, STAGING_IMAGE_SIZE - FLASH_SECTOR_SIZE);
 }
 
+/* ================================================== *
+ * Page compression
+ * ================================================== */
+
+/* Firmware pages are compressed one at a time, so each can still be requested again on its own and
+   the decoder needs no other window than the page it's rebuilding. Tokens are:
+     0xxxxxxx           x + 1 literal bytes follow
+     1xxxxxxx dddddddd  copy x + FW_LZ_MIN_MATCH bytes from d + 1 bytes back, may overlap (runs) */
+#define LZ_MAX_LITERALS 0x80
+#define LZ_MAX_MATCH    (0x7f + FW_LZ_MIN_MATCH)
+
+static inline uint8_t lz_hash(const uint8_t *data) {
+    return (data[0] * 33 + data[1] * 7 + data[2]) & 0xff;
+}
+
+static inline uint32_t lz_match_length(const uint8_t *page, uint32_t from, uint32_t pos) {
+    uint32_t length = 0;
+
+    while (pos + length < FLASH_PAGE_SIZE && length < LZ_MAX_MATCH && page[from + length] == page[pos + length])
+        length++;
+
+    return length;
+}
+
+/* Greedy, with the last position of each 3 byte hash and the previous byte (for runs) as candidates.
+   Returns the compressed length, or 0 if it doesn't come out shorter than FLASH_PAGE_SIZE. */
+uint32_t compress_page(const uint8_t *page, uint8_t *out) {
+    int16_t last[256];
+    uint32_t pos = 0, length = 0, literals = 0;
+
+    memset(last, 0xff, sizeof(last));
+
+    while (pos <= FLASH_PAGE_SIZE) {
+        uint32_t best = 0, distance = 0;
+
+        if (pos + FW_LZ_MIN_MATCH <= FLASH_PAGE_SIZE) {
+            uint8_t hash = lz_hash(&page[pos]);
+            int16_t candidate = last[hash];
+
+            last[hash] = pos;
+
+            if (candidate >= 0 && pos - candidate <= 256) {
+                best     = lz_match_length(page, candidate, pos);
+                distance = pos - candidate;
+            }
+
+            if (pos && distance != 1) {
+                uint32_t run = lz_match_length(page, pos - 1, pos);
+
+                if (run > best) {
+                    best     = run;
+                    distance = 1;
+                }
+            }
+        }
+
+        /* Literals so far go out before a match, when there are too many of them, or at the end */
+        if (literals && (best >= FW_LZ_MIN_MATCH || literals == LZ_MAX_LITERALS || pos == FLASH_PAGE_SIZE)) {
+            if (length + 1 + literals >= FLASH_PAGE_SIZE)
+                return 0;
+
+            out[length++] = literals - 1;
+            memcpy(&out[length], &page[pos - literals], literals);
+            length += literals;
+            literals = 0;
+        }
+
+        if (pos == FLASH_PAGE_SIZE)
+            break;
+
+        if (best < FW_LZ_MIN_MATCH) {
+            literals++;
+            pos++;
+            continue;
+        }
+
+        if (length + 2 >= FLASH_PAGE_SIZE)
+            return 0;
+
+        out[length++] = 0x80 | (best - FW_LZ_MIN_MATCH);
+        out[length++] = distance - 1;
+
+        /* Positions inside the match can start the next one too */
+        for (uint32_t end = pos + best; ++pos < end;)
+            if (pos + FW_LZ_MIN_MATCH <= FLASH_PAGE_SIZE)
+                last[lz_hash(&page[pos])] = pos;
+    }
+
+    return length;
+}
+
+/* Returns false unless the input decodes to exactly one page */
+bool decompress_page(const uint8_t *in, uint32_t length, uint8_t *page) {
+    uint32_t pos = 0, out = 0;
+
+    while (pos < length) {
+        uint8_t token = in[pos++];
+
+        if (token < 0x80) {
+            uint32_t count = token + 1;
+
+            if (pos + count > length || out + count > FLASH_PAGE_SIZE)
+                return false;
+
+            memcpy(&page[out], &in[pos], count);
+            pos += count;
+            out += count;
+            continue;
+        }
+
+        if (pos >= length)
+            return false;
+
+        uint32_t count = (token & 0x7f) + FW_LZ_MIN_MATCH, distance = in[pos++] + 1;
+
+        if (distance > out || out + count > FLASH_PAGE_SIZE)
+            return false;
+
+        /* Byte by byte, a match can overlap what it's producing */
+        for (uint32_t i = 0; i < count; i++, out++)
+            page[out] = page[out - distance];
+    }
+
+    return out == FLASH_PAGE_SIZE;
+}
+
 /* ================================================== *
  * Flash and config functions
  * ================================================== */
 
 void wipe_config(void) {
-    uint32_t ints = save_and_disable_interrupts();
-    flash_range_erase((uint32_t)ADDR_CONFIG - XIP_BASE, FLASH_SECTOR_SIZE);
-    restore_interrupts(ints);
+    queue_flash_erase(&global_state, (uint32_t)ADDR_CONFIG - XIP_BASE);
+    wait_for_flash(&global_state);
 }
 
+/* Returns once the page is written, see queue_flash_page() for not waiting */
 void write_flash_page(uint32_t target_addr, uint8_t *buffer) {
     /* Start of sector == first 256-byte page in a 4096 byte block */
     bool is_sector_start = (target_addr & 0xf00) == 0;
 
-    uint32_t ints = save_and_disable_interrupts();
     if (is_sector_start)
-        flash_range_erase(target_addr, FLASH_SECTOR_SIZE);
+        queue_flash_erase(&global_state, target_addr);
 
-    flash_range_program(target_addr, buffer, FLASH_PAGE_SIZE);
-    restore_interrupts(ints);
+    queue_flash_page(&global_state, target_addr, buffer);
+    wait_for_flash(&global_state);
 }
 
 void load_config(device_t *state) {
@@ -76,7 +315,9 @@ void load_config(device_t *state) {
     config_t *running_config = &state->config;
 
     /* Load the flash config first, including the checksum */
+    lock_flash(state);
     memcpy(running_config, config, sizeof(config_t));
+    unlock_flash(state);
 
     /* Calculate and update checksum, size without checksum */
     uint8_t checksum = calc_crc32((uint8_t *)running_config, sizeof(config_t) - sizeof(uint32_t));
@@ -93,6 +334,9 @@ void load_config(device_t *state) {
     /* On any condition failing, we fall back to default config */
     if (magic_header_fail || checksum_fail || version_fail)
         memcpy(running_config, &default_config, sizeof(config_t));
+
+    /* Precompute the mouse acceleration lookup table */
+    build_acceleration_table(state);
 }
 
 void save_config(device_t *state) {
@@ -106,8 +350,9 @@ void save_config(device_t *state) {
     memcpy(state->page_buffer, raw_config, sizeof(config_t));
     memset(state->page_buffer + sizeof(config_t), 0, FLASH_PAGE_SIZE - sizeof(config_t));
 
-    /* Write the new config to flash */
-    write_flash_page((uint32_t)ADDR_CONFIG - XIP_BASE, state->page_buffer);
+    /* Write the new config to flash, in the background so input keeps flowing during the erase */
+    queue_flash_erase(state, (uint32_t)ADDR_CONFIG - XIP_BASE);
+    queue_flash_page(state, (uint32_t)ADDR_CONFIG - XIP_BASE, state->page_buffer);
 }
 
 void reset_config_timer(device_t *state) {
@@ -146,15 +391,59 @@ void request_byte(device_t *state, uint32_t address) {
     };
     state->fw.byte_done = false;
 
-    queue_try_add(&global_state.uart_tx_queue, &packet);
+    queue_uart_packet(state, &packet);
+}
+
+/* Requests for firmware_page_task(). Where the heartbeat has our link version, these have the one
+   both boards speak, which decides how the answer is sent. */
+static bool request_firmware(device_t *state, enum packet_type_e type, uint32_t value) {
+    uart_packet_t packet = {
+        .data32[0] = value,
+        .type = type,
+    };
+    packet.data[6] = state->peer_link_version < LINK_VERSION ? state->peer_link_version : LINK_VERSION;
+
+    return queue_uart_packet(state, &packet);
+}
+
+/* Asks for a whole page */
+bool request_page(device_t *state, uint32_t page) {
+    return request_firmware(state, REQUEST_PAGE_MSG, page);
+}
+
+/* Asks for the CRC32 of every sector of the other board's image */
+bool request_manifest(device_t *state) {
+    return request_firmware(state, REQUEST_MANIFEST_MSG, 0);
 }
 
 void reboot(void) {
+    /* A config save might still be on its way to flash */
+    wait_for_flash(&global_state);
     *((volatile uint32_t*)(PPB_BASE + 0x0ED0C)) = 0x5FA0004;
 }
 
-bool is_start_of_packet(device_t *state) {
-    return (uart_rxbuf[state->dma_ptr] == START1 && uart_rxbuf[NEXT_RING_IDX(state->dma_ptr)] == START2);
+/* Length of the frame starting at dma_ptr, or 0 if there's no valid frame start there.
+   Needs at least the first 3 bytes to be in. */
+uint32_t get_frame_length(device_t *state) {
+    uint32_t ptr = state->dma_ptr;
+
+    if (uart_rxbuf[ptr] != START1)
+        return 0;
+
+    ptr = NEXT_RING_IDX(ptr);
+
+    if (uart_rxbuf[ptr] == START2)
+        return RAW_PACKET_LENGTH;
+
+    if (uart_rxbuf[ptr] != START2_LONG)
+        return 0;
+
+    uint8_t len = uart_rxbuf[NEXT_RING_IDX(ptr)];
+
+    if (len < PACKET_DATA_LENGTH || len > LINK_MAX_PAYLOAD)
+        return 0;
+
+    return LINK_FRAME_LENGTH(len);
 }
 
 uint32_t get_ptr_delta(uint32_t current_pointer, device_t *state) {
@@ -171,16 +460,75 @@ uint32_t get_ptr_delta(uint32_t current_pointer, device_t *state) {
     return delta;
 }
 
-void fetch_packet(device_t *state) {
-    uint8_t *dst = (uint8_t *)&state->in_packet;
+/* The XOR of a good packet's data and checksum is 0, so XOR-ing the whole frame leaves just the
+   preamble and type. Word aligned frames (the usual case, packets are 12 bytes) go 4 bytes at a time. */
+static bool verify_frame(const uint8_t *frame, uint32_t length) {
+    if (frame[1] == START2_LONG)
+        return calc_crc16(&frame[START_LENGTH], length - START_LENGTH) == 0;
+
+    uint8_t expected = START1 ^ START2 ^ frame[START_LENGTH];
+
+    if ((uintptr_t)frame & 3)
+        return calc_checksum(frame, RAW_PACKET_LENGTH) == expected;
 
-    for (int i = 0; i < RAW_PACKET_LENGTH; i++) {
-        /* Skip the header preamble */
-        if (i >= START_LENGTH)
-            dst[i - START_LENGTH] = uart_rxbuf[state->dma_ptr];
+    _Static_assert(RAW_PACKET_LENGTH == 3 * sizeof(uint32_t), "Frame is expected to be 3 words");
 
-        state->dma_ptr = NEXT_RING_IDX(state->dma_ptr);
+    uint32_t words[3];
+    memcpy(words, __builtin_assume_aligned(frame, 4), sizeof(words));
+
+    uint32_t sum = words[0] ^ words[1] ^ words[2];
+    sum ^= sum >> 16;
+    sum ^= sum >> 8;
+
+    return (uint8_t)sum == expected;
+}
+
+/* Returns the packet in the length byte long frame at dma_ptr and moves past it. If the CRC or checksum
+   is wrong, returns NULL and only skips the preamble, the length might have been what got corrupted and
+   the next frame could start inside this one. Frames are used in place in uart_rxbuf, only the ones
+   wrapping around the end of the ring are copied to in_frame. Either way it's only valid until the
+   next call. Long frames come back as the uart_packet_t their link_packet_t starts with,
+   uart_rx_payload_len says how much data there is. */
+uart_packet_t *fetch_packet(device_t *state, uint32_t length) {
+    uint32_t start = state->dma_ptr;
+    const uint8_t *frame = &uart_rxbuf[start];
+
+    state->dma_ptr = (start + length) & (DMA_RX_BUFFER_SIZE - 1);
+
+    if (start + length > DMA_RX_BUFFER_SIZE) {
+        uint32_t head = DMA_RX_BUFFER_SIZE - start;
+
+        memcpy(state->in_frame, frame, head);
+        memcpy(state->in_frame + head, uart_rxbuf, length - head);
+        frame = state->in_frame;
+    }
+
+    bool valid = verify_frame(frame, length);
+
+    if (valid && frame[1] == START2_LONG) {
+        state->peer_long_frames    = true;
+        state->uart_rx_payload_len = frame[START_LENGTH];
+        return (uart_packet_t *)(frame + LINK_HEADER_LENGTH - TYPE_LENGTH);
     }
+
+    /* A board sending long frames sends its heartbeats in them too. A regular heartbeat means it restarted
+       or stopped hearing ours, and it's the first thing a board sends after a restart. */
+    if (valid && frame[START_LENGTH] == HEARTBEAT_MSG)
+        state->peer_long_frames = false;
+
+    /* Otherwise a board sending long frames sends nothing else, so a regular one from it is noise that got past the XOR */
+    if (valid && !state->peer_long_frames) {
+        state->uart_rx_payload_len = PACKET_DATA_LENGTH;
+        return (uart_packet_t *)(frame + START_LENGTH);
+    }
+
+    if (frame[1] == START2_LONG)
+        state->uart_rx_crc_errors++;
+    else
+        state->uart_rx_checksum_errors++;
+
+    state->dma_ptr = (start + START_LENGTH) & (DMA_RX_BUFFER_SIZE - 1);
+    return NULL;
 }
 
 /* Validating any input is mandatory. Only packets of these type are allowed
@@ -24,6 +24,25 @@ SHORTCUTS = {
 STATUS_ = [
     FormField(78, "Running FW version", None, {}, "uint16", elem="uint16"),
     FormField(79, "Running FW checksum", None, {}, "uint32", elem="hex_info"),
+    FormField(83, "Mouse latency (μs)", None, {}, "uint32"),
+    FormField(84, "Max mouse latency (μs)", None, {}, "uint32"),
+    FormField(85, "UART packets per pass", None, {}, "uint32"),
+    FormField(86, "Max UART packets per pass", None, {}, "uint32"),
+    FormField(87, "Max UART RX backlog (bytes)", None, {}, "uint32"),
+    FormField(88, "UART RX latency (μs)", None, {}, "uint32"),
+    FormField(89, "Max UART RX latency (μs)", None, {}, "uint32"),
+    FormField(90, "Rejected UART packets", None, {}, "uint32"),
+    FormField(91, "UART CRC errors", None, {}, "uint32"),
+    FormField(92, "UART checksum errors", None, {}, "uint32"),
+    FormField(93, "UART bytes skipped", None, {}, "uint32"),
+    FormField(94, "Max UART input queue", None, {}, "uint32"),
+    FormField(95, "UART input wait (μs)", None, {}, "uint32"),
+    FormField(96, "Max UART input wait (μs)", None, {}, "uint32"),
+    FormField(97, "Max UART bulk queue", None, {}, "uint32"),
+    FormField(98, "UART bulk wait (μs)", None, {}, "uint32"),
+    FormField(99, "Max UART bulk wait (μs)", None, {}, "uint32"),
+    FormField(196, "Mouse packets merged", None, {}, "uint32"),
+    FormField(197, "Mouse packets sent as deltas", None, {}, "uint32"),
 ]
 
 CONFIG_ = [
@@ -53,8 +72,23 @@ OUTPUT_ = [
     FormField(10, "Only If Inactive", None, {}, "uint8", "checkbox"),
     FormField(11, "Idle Time (μs)", None, {}, "uint64"),
     FormField(12, "Max Time (μs)", None, {}, "uint64"),
+    FormField(1004, "Acceleration Curve", elem="label"),
+    *[field for point in range(7) for field in (
+        FormField(13 + 2 * point, f"Point {point + 1} Magnitude", None, {}, "uint16"),
+        FormField(14 + 2 * point, f"Point {point + 1} Factor (x4096)", None, {}, "uint16"),
+    )],
 ]
 
+# Each core has MAX_TASKS_PER_CORE stats slots in the API, whether it runs that many tasks or not
+TASK_SLOTS_PER_CORE = 8
+
+TASKS_ = [
+    ["USB Device", "Watchdog", "Keyboard Queue", "Mouse Queue", "HID Queue", "UART TX", "Flash Writer"],
+    ["USB Host", "Packet Receiver", "LED Blink", "Screensaver", "Firmware Upgrade", "Heartbeat"],
+]
+
+TASK_STATS_ = ["Runs", "Min (μs)", "Max (μs)", "Avg (μs)", "Max Late (μs)", "Avg Late (μs)"]
+
 def generate_output(base, data):
     output = [
         {
@@ -80,3 +114,15 @@ def output_status():
 
 def output_config():
     return generate_output(0, data=CONFIG_)
+
+def output_task_stats(base=100):
+    stride = len(TASK_STATS_)
+    output = [
+        {
+            "name": f"Core {core}: {name}",
+            "keys": [base + stride * (core * TASK_SLOTS_PER_CORE + task) + n for n in range(stride)],
+        }
+        for core, names in enumerate(TASKS_)
+        for task, name in enumerate(names)
+    ]
+    return output
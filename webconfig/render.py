@@ -45,6 +45,8 @@ if __name__ == "__main__":
         screen_B=output_B(),
         status=output_status(),
         config=output_config(),
+        task_stats=output_task_stats(),
+        task_stat_names=TASK_STATS_,
     )
 
     # Compress file and encode to base64
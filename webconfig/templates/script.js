@@ -1,5 +1,6 @@
 const mgmtReportId = 6;
 var device;
+var statsTimer;
 
 const packetType = {
   keyboardReportMsg: 1, mouseReportMsg: 2, outputSelectMsg: 3, firmwareUpgradeMsg: 4, switchLockMsg: 7,
@@ -159,6 +160,25 @@ async function readHandler() {
   await sendReport(packetType.getValAllMsg);
 }
 
+/* Task statistics are polled once a second while live stats are toggled on */
+async function statsHandler() {
+  for (const element of document.querySelectorAll('.stats'))
+    await sendReport(packetType.getValMsg, [element.getAttribute('data-key')]);
+}
+
+async function liveStatsHandler() {
+  if (statsTimer) {
+    clearInterval(statsTimer);
+    statsTimer = null;
+    return;
+  }
+
+  if (!device || !device.opened)
+    await connectHandler();
+
+  statsTimer = setInterval(statsHandler, 1000);
+}
+
 async function handleInputReport(event) {
   var data = new Uint8Array(event.data.buffer);
   var key = data[3];